@@ -0,0 +1,67 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2019 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_MESA_ARRAYCALIBRATOR_H
+#define INCLUDED_MESA_ARRAYCALIBRATOR_H
+
+#include <gnuradio/sync_block.h>
+#include <mesa/api.h>
+
+namespace gr {
+namespace mesa {
+
+/*!
+ * \brief Phase and gain calibration for coherent multi-channel receivers
+ * \ingroup mesa
+ *
+ * Each channel's phase and gain offset relative to a reference channel is
+ * estimated with an FFT cross-correlation, and each channel is corrected
+ * with a single complex multiply.  The estimate is refreshed on a
+ * configurable interval or on request.
+ */
+class MESA_API ArrayCalibrator : virtual public gr::sync_block {
+public:
+  typedef std::shared_ptr<ArrayCalibrator> sptr;
+
+  /*!
+   * \brief Return a shared_ptr to a new instance of mesa::ArrayCalibrator.
+   *
+   * To avoid accidental use of raw pointers, mesa::ArrayCalibrator's
+   * constructor is in a private implementation
+   * class. mesa::ArrayCalibrator::make is the public interface for
+   * creating new instances.
+   */
+  static sptr make(int numChannels, int referenceChannel, int corrLength,
+                   float sampleRate, float intervalSec, float alpha);
+
+  virtual float getAlpha() const = 0;
+  virtual void setAlpha(float newValue) = 0;
+
+  virtual float getInterval() const = 0;
+  virtual void setInterval(float newValue) = 0;
+
+  // Force a new estimate on the next samples
+  virtual void recalibrate() = 0;
+};
+
+} // namespace mesa
+} // namespace gr
+
+#endif /* INCLUDED_MESA_ARRAYCALIBRATOR_H */
@@ -47,7 +47,12 @@ public:
   static sptr make(double freq, double sampleRate, double maxDrift,
                    double minWidth, double expectedWidth, int shiftHolddownMS,
                    int fft_size, float squelchThreshold, int framesToAvg,
-                   float holdUpSec, bool processMessages, int detectionMethod);
+                   float holdUpSec, bool processMessages, int detectionMethod,
+                   int analyzeFrames = 1, int frameStride = 1,
+                   bool adaptiveAnalysis = false,
+                   const std::string &sharedSpectrum = "",
+                   int detectionOutput = 1, int windowType = 2,
+                   bool zoomAnalysis = false);
 
   virtual float getSquelch() const = 0;
   virtual void setSquelch(float newValue) = 0;
@@ -63,6 +68,12 @@ public:
 
   virtual double getMaxDrift() const = 0;
   virtual void setMaxDrift(double newValue) = 0;
+
+  virtual int getFFTSize() const = 0;
+  virtual void setFFTSize(int newValue) = 0;
+
+  virtual int getWindowType() const = 0;
+  virtual void setWindowType(int newValue) = 0;
 };
 
 } // namespace mesa
@@ -28,7 +28,7 @@ namespace gr {
 namespace mesa {
 
 /*!
- * \brief <+description of block+>
+ * \brief Streaming statistics of the input floats, output as messages
  * \ingroup mesa
  *
  */
@@ -44,9 +44,13 @@ public:
    * class. mesa::AvgToMsg::make is the public interface for
    * creating new instances.
    */
-  static sptr make(int veclen);
+  static sptr make(int veclen, int reportInterval = 0, int avgType = 1,
+                   int intervalUnits = 1);
 
   virtual void setHold(bool newValue) = 0;
+
+  virtual int getReportInterval() const = 0;
+  virtual void setReportInterval(int newValue) = 0;
 };
 
 } // namespace mesa
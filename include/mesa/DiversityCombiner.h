@@ -0,0 +1,60 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2019 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_MESA_DIVERSITYCOMBINER_H
+#define INCLUDED_MESA_DIVERSITYCOMBINER_H
+
+#include <gnuradio/sync_block.h>
+#include <mesa/api.h>
+
+namespace gr {
+namespace mesa {
+
+/*!
+ * \brief Maximal-ratio combiner for time-aligned receiver inputs
+ * \ingroup mesa
+ *
+ * Each input's SNR is estimated from its spectrum, each input is rotated
+ * into phase with the strongest input, and the inputs are summed weighted
+ * by their SNR.
+ */
+class MESA_API DiversityCombiner : virtual public gr::sync_block {
+public:
+  typedef std::shared_ptr<DiversityCombiner> sptr;
+
+  /*!
+   * \brief Return a shared_ptr to a new instance of mesa::DiversityCombiner.
+   *
+   * To avoid accidental use of raw pointers, mesa::DiversityCombiner's
+   * constructor is in a private implementation
+   * class. mesa::DiversityCombiner::make is the public interface for
+   * creating new instances.
+   */
+  static sptr make(int numInputs, int fft_size, int framesToAvg,
+                   float weightAlpha);
+
+  virtual float getWeightAlpha() const = 0;
+  virtual void setWeightAlpha(float newValue) = 0;
+};
+
+} // namespace mesa
+} // namespace gr
+
+#endif /* INCLUDED_MESA_DIVERSITYCOMBINER_H */
@@ -44,7 +44,10 @@ public:
    * class. mesa::LongTermIntegrator::make is the public interface for
    * creating new instances.
    */
-  static sptr make(int fftsize, bool normalize);
+  static sptr make(int fftsize, bool normalize, int integrationMode = 1,
+                   int integrationLength = 0,
+                   const std::string &checkpointFile = "",
+                   float snapshotPeriodSec = 0.0);
   virtual void reset(bool bReset) = 0;
 };
 
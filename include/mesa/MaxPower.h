@@ -46,7 +46,11 @@ public:
    */
   static sptr make(double sampleRate, int fft_size, float squelchThreshold,
                    float framesToAvg, bool produceOut, float stateThreshold,
-                   float holdUpSec);
+                   float holdUpSec, float avgWindowSec = 0.0,
+                   int powerMode = 1,
+                   const std::string &sharedSpectrum = "",
+                   int detectionOutput = 1, int inputType = 1,
+                   int windowType = 2);
 
   virtual float getSquelchThreshold() const = 0;
   virtual void setSquelchThreshold(float newValue) = 0;
@@ -54,6 +58,12 @@ public:
   virtual void setStateThreshold(float newValue) = 0;
   virtual float getHoldTime() const = 0;
   virtual void setHoldTime(float newValue) = 0;
+
+  virtual int getFFTSize() const = 0;
+  virtual void setFFTSize(int newValue) = 0;
+
+  virtual int getWindowType() const = 0;
+  virtual void setWindowType(int newValue) = 0;
 };
 
 } // namespace mesa
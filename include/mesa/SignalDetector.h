@@ -21,7 +21,7 @@
 #ifndef INCLUDED_MESA_SIGNALDETECTOR_H
 #define INCLUDED_MESA_SIGNALDETECTOR_H
 
-#include <gnuradio/sync_block.h>
+#include <gnuradio/block.h>
 #include <mesa/api.h>
 
 namespace gr {
@@ -32,7 +32,7 @@ namespace mesa {
  * \ingroup mesa
  *
  */
-class MESA_API SignalDetector : virtual public gr::sync_block {
+class MESA_API SignalDetector : virtual public gr::block {
 public:
   typedef std::shared_ptr<SignalDetector> sptr;
 
@@ -47,7 +47,13 @@ public:
   static sptr make(int fftsize, float squelchThreshold, double minWidthHz,
                    double maxWidthHz, double radioCenterFreq, double sampleRate,
                    float holdUpSec, int framesToAvg, bool genSignalPDUs,
-                   bool enableDebug, int detectionMethod);
+                   bool enableDebug, int detectionMethod,
+                   int analyzeFrames = 1, int frameStride = 1,
+                   bool adaptiveAnalysis = false,
+                   const std::string &sharedSpectrum = "",
+                   int outputMode = 1, int pduMode = 2,
+                   int detectionOutput = 1, int inputType = 1,
+                   int windowType = 2);
 
   virtual float getSquelch() const = 0;
   virtual void setSquelch(float newValue) = 0;
@@ -60,6 +66,12 @@ public:
 
   virtual double getMaxWidthHz() const = 0;
   virtual void setMaxWidthHz(double newValue) = 0;
+
+  virtual int getFFTSize() const = 0;
+  virtual void setFFTSize(int newValue) = 0;
+
+  virtual int getWindowType() const = 0;
+  virtual void setWindowType(int newValue) = 0;
 };
 
 } // namespace mesa
@@ -45,7 +45,8 @@ public:
    * creating new instances.
    */
   static sptr make(float holdTime, int numInputs, int defaultInput,
-                   int inputBlockSize);
+                   int inputBlockSize, int queueDepth = 0,
+                   int underrunPolicy = 1, int alignmentWindow = 0);
 };
 
 } // namespace mesa
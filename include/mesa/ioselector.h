@@ -21,8 +21,9 @@
 #ifndef INCLUDED_MESA_IOSELECTOR_H
 #define INCLUDED_MESA_IOSELECTOR_H
 
-#include <gnuradio/sync_block.h>
+#include <gnuradio/block.h>
 #include <mesa/api.h>
+#include <vector>
 
 namespace gr {
 namespace mesa {
@@ -32,7 +33,7 @@ namespace mesa {
  * \ingroup mesa
  *
  */
-class MESA_API ioselector : virtual public gr::sync_block {
+class MESA_API ioselector : virtual public gr::block {
 public:
   typedef std::shared_ptr<ioselector> sptr;
 
@@ -45,10 +46,16 @@ public:
    * creating new instances.
    */
   static sptr make(int numinputs, int numoutputs, int inputport, int outputport,
-                   int itemsize);
+                   int itemsize, int unselectedOutput = 2,
+                   const std::vector<int> &routes = std::vector<int>(),
+                   int crossfadeSamples = 0);
 
   virtual void set_input_index(int newValue) = 0;
   virtual void set_output_index(int newValue) = 0;
+
+  // Crossbar routing table: routes[output] is the input that feeds it, or -1
+  // for none.  The new table takes effect at the start of the next work call.
+  virtual void set_routes(const std::vector<int> &routes) = 0;
 };
 
 } // namespace mesa
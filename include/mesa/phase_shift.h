@@ -28,7 +28,8 @@ namespace gr {
 namespace mesa {
 
 /*!
- * \brief This block will shift the incoming signal by the specified radians.
+ * \brief This block will shift the incoming signal by the specified radians,
+ * optionally with a linear phase ramp (radians/sample) on top.
  * \ingroup mesa
  *
  */
@@ -44,9 +45,11 @@ public:
    * class. mesa::phase_shift::make is the public interface for
    * creating new instances.
    */
-  static sptr make(float shift_in_radians);
+  static sptr make(float shift_in_radians, float ramp_rad_per_sample = 0.0);
   virtual float get_shift() const = 0;
   virtual void set_shift(float newValue) = 0;
+  virtual float get_ramp() const = 0;
+  virtual void set_ramp(float newValue) = 0;
 };
 
 } // namespace mesa
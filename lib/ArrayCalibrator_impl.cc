@@ -0,0 +1,323 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2019 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "ArrayCalibrator_impl.h"
+#include <gnuradio/io_signature.h>
+#include <volk/volk.h>
+
+namespace gr {
+namespace mesa {
+
+ArrayCalibrator::sptr ArrayCalibrator::make(int numChannels,
+                                            int referenceChannel,
+                                            int corrLength, float sampleRate,
+                                            float intervalSec, float alpha) {
+  return gnuradio::get_initial_sptr(
+      new ArrayCalibrator_impl(numChannels, referenceChannel, corrLength,
+                               sampleRate, intervalSec, alpha));
+}
+
+/*
+ * The private constructor
+ */
+ArrayCalibrator_impl::ArrayCalibrator_impl(int numChannels,
+                                           int referenceChannel,
+                                           int corrLength, float sampleRate,
+                                           float intervalSec, float alpha)
+    : gr::sync_block("ArrayCalibrator",
+                     gr::io_signature::make(numChannels, numChannels,
+                                            sizeof(gr_complex)),
+                     gr::io_signature::make(numChannels, numChannels,
+                                            sizeof(gr_complex))) {
+  if ((referenceChannel < 0) || (referenceChannel >= numChannels))
+    throw std::out_of_range(
+        "[ArrayCalibrator] Reference channel must be one of the inputs.");
+
+  if (corrLength <= 0)
+    throw std::out_of_range(
+        "[ArrayCalibrator] Correlation length must be > 0.");
+
+  d_numChannels = numChannels;
+  d_referenceChannel = referenceChannel;
+  d_corrLength = corrLength;
+  d_sampleRate = sampleRate;
+
+  setAlpha(alpha);
+  setInterval(intervalSec);
+
+  corrFFTSize = 1;
+  while (corrFFTSize < 2 * d_corrLength)
+    corrFFTSize <<= 1;
+
+  corrForward = new FFT(FFTDIRECTION_FORWARD, corrFFTSize);
+  corrReverse = new FFT(FFTDIRECTION_BACKWARD, corrFFTSize);
+
+  size_t memAlignment = volk_get_alignment();
+  refSpectrum =
+      (SComplex *)volk_malloc(corrFFTSize * sizeof(SComplex), memAlignment);
+  corrMagnitude =
+      (float *)volk_malloc(corrFFTSize * sizeof(float), memAlignment);
+
+  for (int i = 0; i < d_numChannels; i++)
+    captureBuffers.push_back((SComplex *)volk_malloc(
+        d_corrLength * sizeof(SComplex), memAlignment));
+
+  captureFill = 0;
+  samplesSinceEstimate = 0;
+  estimatePending = true;
+
+  // No correction until the first estimate comes in
+  corrections.assign(d_numChannels, gr_complex(1.0, 0.0));
+  correctionsInitialized = false;
+
+  phaseOffsets.assign(d_numChannels, 0.0);
+  gainOffsets.assign(d_numChannels, 0.0);
+  lags.assign(d_numChannels, 0);
+
+  message_port_register_out(pmt::mp("calibration"));
+
+  message_port_register_in(pmt::mp("recalibrate"));
+  set_msg_handler(pmt::mp("recalibrate"),
+                  [this](pmt::pmt_t msg) { this->recalibrate(); });
+}
+
+/*
+ * Our virtual destructor.
+ */
+ArrayCalibrator_impl::~ArrayCalibrator_impl() { bool retVal = stop(); }
+
+bool ArrayCalibrator_impl::stop() {
+  if (corrForward) {
+    delete corrForward;
+    corrForward = NULL;
+  }
+
+  if (corrReverse) {
+    delete corrReverse;
+    corrReverse = NULL;
+  }
+
+  if (refSpectrum) {
+    volk_free(refSpectrum);
+    refSpectrum = NULL;
+  }
+
+  if (corrMagnitude) {
+    volk_free(corrMagnitude);
+    corrMagnitude = NULL;
+  }
+
+  for (int i = 0; i < captureBuffers.size(); i++) {
+    if (captureBuffers[i]) {
+      volk_free(captureBuffers[i]);
+      captureBuffers[i] = NULL;
+    }
+  }
+
+  return true;
+}
+
+float ArrayCalibrator_impl::getAlpha() const { return d_alpha; }
+
+void ArrayCalibrator_impl::setAlpha(float newValue) {
+  // alpha of 1.0 means no smoothing, just use the latest estimate
+  if (newValue <= 0.0 || newValue > 1.0)
+    newValue = 1.0;
+
+  d_alpha = newValue;
+}
+
+float ArrayCalibrator_impl::getInterval() const { return d_intervalSec; }
+
+void ArrayCalibrator_impl::setInterval(float newValue) {
+  gr::thread::scoped_lock guard(d_mutex);
+
+  // An interval of 0 only estimates at start and on request
+  if (newValue < 0.0)
+    newValue = 0.0;
+
+  d_intervalSec = newValue;
+  intervalSamples = (long)(d_intervalSec * d_sampleRate);
+}
+
+void ArrayCalibrator_impl::recalibrate() {
+  gr::thread::scoped_lock guard(d_mutex);
+
+  estimatePending = true;
+  captureFill = 0;
+}
+
+void ArrayCalibrator_impl::capture(int noutput_items,
+                                   gr_vector_const_void_star &input_items) {
+  int numToCopy = d_corrLength - captureFill;
+
+  if (numToCopy > noutput_items)
+    numToCopy = noutput_items;
+
+  for (int i = 0; i < d_numChannels; i++) {
+    const gr_complex *in = (const gr_complex *)input_items[i];
+    memcpy(&captureBuffers[i][captureFill], in, numToCopy * sizeof(SComplex));
+  }
+
+  captureFill += numToCopy;
+}
+
+void ArrayCalibrator_impl::estimate() {
+  // For each channel, R = IFFT(FFT(in) * conj(FFT(ref))).  The peak of |R|
+  // gives the sample lag.  The correction is applied without any delay, so
+  // the phase is taken from R at zero lag (the phase at the peak would be
+  // off by 2*pi*f*lag/fs on a channel that isn't sample aligned).  Gain
+  // comes from the ratio of the channel energies.
+  long halfFFT = corrFFTSize / 2;
+  size_t windowBytes = d_corrLength * sizeof(SComplex);
+  size_t padBytes = (corrFFTSize - d_corrLength) * sizeof(SComplex);
+
+  SComplex *fftIn = corrForward->getInputBuffer();
+  SComplex *fftOut = corrForward->getOutputBuffer();
+  SComplex *corrOut = corrReverse->getOutputBuffer();
+
+  const SComplex *ref = captureBuffers[d_referenceChannel];
+
+  memcpy(fftIn, ref, windowBytes);
+  memset(&fftIn[d_corrLength], 0x00, padBytes);
+  corrForward->execute();
+  memcpy(refSpectrum, fftOut, corrFFTSize * sizeof(SComplex));
+
+  gr_complex refEnergy;
+  volk_32fc_x2_conjugate_dot_prod_32fc(&refEnergy, ref, ref, d_corrLength);
+
+  for (int i = 0; i < d_numChannels; i++) {
+    if (i == d_referenceChannel)
+      continue;
+
+    const SComplex *in = captureBuffers[i];
+
+    memcpy(fftIn, in, windowBytes);
+    memset(&fftIn[d_corrLength], 0x00, padBytes);
+    corrForward->execute();
+
+    volk_32fc_x2_multiply_conjugate_32fc(corrReverse->getInputBuffer(), fftOut,
+                                         refSpectrum, corrFFTSize);
+    corrReverse->execute();
+
+    volk_32fc_magnitude_squared_32f(corrMagnitude, corrOut, corrFFTSize);
+
+    uint32_t peakIndex;
+    volk_32f_index_max_32u(&peakIndex, corrMagnitude, corrFFTSize);
+
+    // Upper half of the result is negative lags
+    long lag = peakIndex;
+    if (lag >= halfFFT)
+      lag -= corrFFTSize;
+
+    gr_complex zeroLag = corrOut[0];
+    float zeroLagMag = std::abs(zeroLag);
+
+    gr_complex energy;
+    volk_32fc_x2_conjugate_dot_prod_32fc(&energy, in, in, d_corrLength);
+
+    if ((zeroLagMag <= 0.0) || (energy.real() <= 0.0) ||
+        (refEnergy.real() <= 0.0)) {
+      // Nothing to lock on to (e.g. a dead channel).  Keep what we had.
+      continue;
+    }
+
+    // Rotate back by the measured phase and scale to the reference level
+    float gain = sqrtf(refEnergy.real() / energy.real());
+    gr_complex newCorrection = std::conj(zeroLag) / zeroLagMag * gain;
+
+    if (correctionsInitialized)
+      corrections[i] =
+          d_alpha * newCorrection + (1.0f - d_alpha) * corrections[i];
+    else
+      corrections[i] = newCorrection;
+
+    phaseOffsets[i] = std::arg(zeroLag);
+    gainOffsets[i] = 10.0 * log10(energy.real() / refEnergy.real());
+    lags[i] = lag;
+  }
+
+  correctionsInitialized = true;
+
+  sendCalibration();
+}
+
+void ArrayCalibrator_impl::sendCalibration() {
+  // Per-channel phase offset (rad), gain offset (dB) and sample lag of each
+  // channel relative to the reference
+  pmt::pmt_t meta = pmt::make_dict();
+
+  meta = pmt::dict_add(meta, pmt::mp("referenceChannel"),
+                       pmt::mp(d_referenceChannel));
+  meta = pmt::dict_add(meta, pmt::mp("phase"),
+                       pmt::init_f32vector(d_numChannels, phaseOffsets));
+  meta = pmt::dict_add(meta, pmt::mp("gainDB"),
+                       pmt::init_f32vector(d_numChannels, gainOffsets));
+  meta = pmt::dict_add(meta, pmt::mp("lag"),
+                       pmt::init_s32vector(d_numChannels, &lags[0]));
+
+  pmt::pmt_t pdu = pmt::cons(meta, pmt::PMT_NIL);
+
+  message_port_pub(pmt::mp("calibration"), pdu);
+}
+
+int ArrayCalibrator_impl::work(int noutput_items,
+                               gr_vector_const_void_star &input_items,
+                               gr_vector_void_star &output_items) {
+  gr::thread::scoped_lock guard(d_mutex);
+
+  if (estimatePending) {
+    capture(noutput_items, input_items);
+
+    if (captureFill >= d_corrLength) {
+      estimate();
+
+      estimatePending = false;
+      captureFill = 0;
+      samplesSinceEstimate = 0;
+    }
+  } else if (intervalSamples > 0) {
+    samplesSinceEstimate += noutput_items;
+
+    if (samplesSinceEstimate >= intervalSamples)
+      estimatePending = true;
+  }
+
+  // One pass per channel with the current correction
+  for (int i = 0; i < d_numChannels; i++) {
+    const gr_complex *in = (const gr_complex *)input_items[i];
+    gr_complex *out = (gr_complex *)output_items[i];
+
+    if (i == d_referenceChannel)
+      memcpy(out, in, noutput_items * sizeof(gr_complex));
+    else
+      volk_32fc_s32fc_multiply_32fc(out, in, corrections[i], noutput_items);
+  }
+
+  // Tell runtime system how many output items we produced.
+  return noutput_items;
+}
+
+} /* namespace mesa */
+} /* namespace gr */
@@ -0,0 +1,96 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2019 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_MESA_ARRAYCALIBRATOR_IMPL_H
+#define INCLUDED_MESA_ARRAYCALIBRATOR_IMPL_H
+
+#include "signals_mesa.h"
+#include <mesa/ArrayCalibrator.h>
+
+using namespace MesaSignals;
+
+namespace gr {
+namespace mesa {
+
+class ArrayCalibrator_impl : public ArrayCalibrator {
+private:
+  int d_numChannels;
+  int d_referenceChannel;
+  int d_corrLength;
+  float d_sampleRate;
+  float d_intervalSec;
+  float d_alpha;
+
+  boost::mutex d_mutex;
+
+  // Cross-correlation.  The FFT size is at least twice the correlation
+  // length so the zero-padded circular correlation doesn't wrap.
+  int corrFFTSize;
+  FFT *corrForward;
+  FFT *corrReverse;
+  SComplex *refSpectrum;
+  float *corrMagnitude;
+
+  // Samples from each channel collected for the next estimate.  Estimates
+  // may straddle work() calls.
+  std::vector<SComplex *> captureBuffers;
+  int captureFill;
+
+  long intervalSamples;
+  long samplesSinceEstimate;
+  bool estimatePending;
+
+  // Current per-channel correction: out = in * corrections[i]
+  std::vector<gr_complex> corrections;
+  bool correctionsInitialized;
+
+  // Last estimate, reported on the calibration port
+  std::vector<float> phaseOffsets;
+  std::vector<float> gainOffsets;
+  std::vector<int> lags;
+
+  void capture(int noutput_items, gr_vector_const_void_star &input_items);
+  void estimate();
+  void sendCalibration();
+
+public:
+  ArrayCalibrator_impl(int numChannels, int referenceChannel, int corrLength,
+                       float sampleRate, float intervalSec, float alpha);
+  ~ArrayCalibrator_impl();
+
+  virtual bool stop();
+
+  virtual float getAlpha() const;
+  virtual void setAlpha(float newValue);
+
+  virtual float getInterval() const;
+  virtual void setInterval(float newValue);
+
+  virtual void recalibrate();
+
+  // Where all the action really happens
+  int work(int noutput_items, gr_vector_const_void_star &input_items,
+           gr_vector_void_star &output_items);
+};
+
+} // namespace mesa
+} // namespace gr
+
+#endif /* INCLUDED_MESA_ARRAYCALIBRATOR_IMPL_H */
@@ -39,11 +39,14 @@ AutoDopplerCorrect::sptr AutoDopplerCorrect::make(
     double freq, double sampleRate, double maxDrift, double minWidth,
     double expectedWidth, int shiftHolddownMS, int fft_size,
     float squelchThreshold, int framesToAvg, float holdUpSec,
-    bool processMessages, int detectionMethod) {
+    bool processMessages, int detectionMethod, int analyzeFrames,
+    int frameStride, bool adaptiveAnalysis, const std::string &sharedSpectrum,
+    int detectionOutput, int windowType, bool zoomAnalysis) {
   return gnuradio::get_initial_sptr(new AutoDopplerCorrect_impl(
       freq, sampleRate, maxDrift, minWidth, expectedWidth, shiftHolddownMS,
       fft_size, squelchThreshold, framesToAvg, holdUpSec, processMessages,
-      detectionMethod));
+      detectionMethod, analyzeFrames, frameStride, adaptiveAnalysis,
+      sharedSpectrum, detectionOutput, windowType, zoomAnalysis));
 }
 
 /*
@@ -53,12 +56,29 @@ AutoDopplerCorrect_impl::AutoDopplerCorrect_impl(
     double freq, double sampleRate, double maxDrift, double minWidth,
     double expectedWidth, int shiftHolddownMS, int fft_size,
     float squelchThreshold, int framesToAvg, float holdUpSec,
-    bool processMessages, int detectionMethod)
+    bool processMessages, int detectionMethod, int analyzeFrames,
+    int frameStride, bool adaptiveAnalysis, const std::string &sharedSpectrum,
+    int detectionOutput, int windowType, bool zoomAnalysis)
     : gr::sync_block("AutoDopplerCorrect",
                      gr::io_signature::make(1, 1, sizeof(gr_complex)),
-                     gr::io_signature::make(1, 1, sizeof(gr_complex))) {
+                     gr::io_signature::make(1, 1, sizeof(gr_complex))),
+      tagKeys(DetectionTagKeys::get()) {
   d_detectionMethod = detectionMethod;
 
+  if ((detectionOutput < DETECTION_OUTPUT_MESSAGES) ||
+      (detectionOutput > DETECTION_OUTPUT_BOTH)) {
+    throw std::out_of_range("[AutoDopplerCorrect] Unknown detection output");
+  }
+
+  d_detectionOutput = detectionOutput;
+
+  if ((windowType < WINDOWTYPE_NONE) ||
+      (windowType > WINDOWTYPE_BLACKMAN_HARRIS)) {
+    throw std::out_of_range("[AutoDopplerCorrect] Unknown window type");
+  }
+
+  d_windowType = windowType;
+
   d_sampleRate = sampleRate;
   d_centerFreq = freq;
 
@@ -69,6 +89,8 @@ AutoDopplerCorrect_impl::AutoDopplerCorrect_impl(
 
   d_framesToAvg = framesToAvg;
   d_fftSize = fft_size;
+  d_requestedFFTSize = fft_size;
+  d_blockSize = fft_size * d_framesToAvg;
 
   d_startInitialized = false;
   d_holdUpSec = holdUpSec;
@@ -94,16 +116,41 @@ AutoDopplerCorrect_impl::AutoDopplerCorrect_impl(
 
   // Set up energy detector
   // -------------------
-  float hzPerBucket = d_sampleRate / d_fftSize;
   d_minWidthHz = minWidth;
   d_maxWidthHz = d_expectedWidth * 1.4;
 
-  float binsForMinHz = d_minWidthHz / hzPerBucket;
-  float minDutyCycle = binsForMinHz / d_fftSize;
+  // Zoom in on just the bins that could hold the signal.  The decimation is
+  // set by the startup max drift and expected width.
+  pZoomDecimator = NULL;
+  pMsgZoomDecimator = NULL;
+  d_zoomDecimation = 1;
+  zoomBuffer = NULL;
+  zoomBufferSize = 0;
+
+  if (zoomAnalysis) {
+    d_zoomDecimation = ZoomDecimator::selectDecimation(
+        d_sampleRate, d_maxDrift + d_expectedWidth, d_fftSize);
+
+    if (d_zoomDecimation > 1) {
+      pZoomDecimator = new ZoomDecimator(d_zoomDecimation);
+      pMsgZoomDecimator = new ZoomDecimator(d_zoomDecimation);
+    }
+  }
+
+  float minDutyCycle = calcMinDutyCycle();
 
   // Create energy analyzer
-  pEnergyAnalyzer =
-      new EnergyAnalyzer(d_fftSize, squelchThreshold, minDutyCycle);
+  pEnergyAnalyzer = new EnergyAnalyzer(d_fftSize / d_zoomDecimation,
+                                       squelchThreshold, minDutyCycle);
+  pEnergyAnalyzer->setFrameStride(analyzeFrames, frameStride,
+                                  adaptiveAnalysis);
+
+  // Zoomed spectra are at a different rate and size than everyone else's
+  if (!pZoomDecimator)
+    pEnergyAnalyzer->setSharedSpectrum(sharedSpectrum);
+
+  if (d_windowType != WINDOWTYPE_BLACKMAN_HARRIS)
+    pEnergyAnalyzer->setWindowType(d_windowType);
   //    	std::cout << "min duty cycle: " << minDutyCycle << std::endl;
 
   // Make sure we have a multiple of fftsize coming in
@@ -135,6 +182,22 @@ bool AutoDopplerCorrect_impl::stop() {
     pMsgOutBuff = NULL;
   }
 
+  if (pZoomDecimator) {
+    delete pZoomDecimator;
+    pZoomDecimator = NULL;
+  }
+
+  if (pMsgZoomDecimator) {
+    delete pMsgZoomDecimator;
+    pMsgZoomDecimator = NULL;
+  }
+
+  if (zoomBuffer) {
+    volk_free(zoomBuffer);
+    zoomBufferSize = 0;
+    zoomBuffer = NULL;
+  }
+
   return true;
 }
 
@@ -148,6 +211,8 @@ float AutoDopplerCorrect_impl::getSquelch() const {
 }
 
 void AutoDopplerCorrect_impl::setSquelch(float newValue) {
+  gr::thread::scoped_lock guard(d_mutex);
+
   pEnergyAnalyzer->setThreshold(newValue);
 }
 
@@ -179,14 +244,19 @@ void AutoDopplerCorrect_impl::setCenterFrequency(double newValue) {
 double AutoDopplerCorrect_impl::getMinWidthHz() const { return d_minWidthHz; }
 
 void AutoDopplerCorrect_impl::setMinWidthHz(double newValue) {
-  double hzPerBucket = d_sampleRate / d_fftSize;
-  double binsForMinHz = d_minWidthHz / hzPerBucket;
-  double minDutyCycle = binsForMinHz / d_fftSize;
-
-  // Create energy analyzer
-  pEnergyAnalyzer->setDutyCycle(minDutyCycle);
+  gr::thread::scoped_lock guard(d_mutex);
 
   d_minWidthHz = newValue;
+
+  pEnergyAnalyzer->setDutyCycle(calcMinDutyCycle());
+}
+
+float AutoDopplerCorrect_impl::calcMinDutyCycle() {
+  // The duty cycle is over the analyzer's bins, which is fewer when zoomed
+  double hzPerBucket = d_sampleRate / (double)d_fftSize;
+  double binsForMinHz = d_minWidthHz / hzPerBucket;
+
+  return binsForMinHz / (double)(d_fftSize / d_zoomDecimation);
 }
 
 double AutoDopplerCorrect_impl::getExpectedWidth() const {
@@ -204,6 +274,109 @@ void AutoDopplerCorrect_impl::setMaxDrift(double newValue) {
   d_maxDrift = newValue;
 }
 
+int AutoDopplerCorrect_impl::getFFTSize() const { return d_fftSize; }
+
+void AutoDopplerCorrect_impl::setFFTSize(int newValue) {
+  gr::thread::scoped_lock guard(d_mutex);
+
+  if (newValue == d_requestedFFTSize)
+    return;
+
+  // The flowgraph's buffers were sized for the startup block size, so an FFT
+  // frame can't be bigger than that.  The DC swap needs an even size, and
+  // when zoomed it has to stay even after decimating.
+  int sizeMultiple = 2 * d_zoomDecimation;
+
+  if ((newValue < sizeMultiple) || ((newValue % sizeMultiple) != 0) ||
+      (newValue > d_blockSize)) {
+    throw std::out_of_range("[AutoDopplerCorrect] FFT size must be a "
+                            "multiple of 2 x the zoom decimation and no "
+                            "larger than the startup block size");
+  }
+
+  d_requestedFFTSize = newValue;
+
+  // The new FFT is planned here, not in work().  It's swapped in at the
+  // start of the next block.  Holding d_mutex keeps work() from swapping
+  // out the analyzer it's built from.
+  analyzerReconfig.queue(pEnergyAnalyzer,
+                         d_requestedFFTSize / d_zoomDecimation, d_windowType);
+}
+
+int AutoDopplerCorrect_impl::getWindowType() const { return d_windowType; }
+
+void AutoDopplerCorrect_impl::setWindowType(int newValue) {
+  gr::thread::scoped_lock guard(d_mutex);
+
+  if (newValue == d_windowType)
+    return;
+
+  if ((newValue < WINDOWTYPE_NONE) || (newValue > WINDOWTYPE_BLACKMAN_HARRIS))
+    throw std::out_of_range("[AutoDopplerCorrect] Unknown window type");
+
+  d_windowType = newValue;
+  analyzerReconfig.queue(pEnergyAnalyzer,
+                         d_requestedFFTSize / d_zoomDecimation, d_windowType);
+}
+
+void AutoDopplerCorrect_impl::applyReconfig() {
+  // Called with d_mutex held, so this is always on a block boundary.
+  if (!analyzerReconfig.swap(pEnergyAnalyzer))
+    return;
+
+  d_fftSize = pEnergyAnalyzer->getFFTSize() * d_zoomDecimation;
+
+  // Average as many frames as fit in the startup block size
+  d_framesToAvg = d_blockSize / d_fftSize;
+
+  if (d_framesToAvg < 1)
+    d_framesToAvg = 1;
+
+  gr::block::set_output_multiple(d_fftSize * d_framesToAvg);
+}
+
+const gr_complex *AutoDopplerCorrect_impl::zoom(ZoomDecimator *pDecimator,
+                                                const gr_complex *in,
+                                                long &numSamples) {
+  if (!pDecimator)
+    return in;
+
+  long numOutputs = numSamples / d_zoomDecimation;
+
+  if (numOutputs > zoomBufferSize) {
+    if (zoomBuffer)
+      volk_free(zoomBuffer);
+
+    size_t memAlignment = volk_get_alignment();
+    zoomBuffer = (gr_complex *)volk_malloc(numOutputs * sizeof(gr_complex),
+                                           memAlignment);
+    zoomBufferSize = numOutputs;
+  }
+
+  numSamples = pDecimator->decimate(in, numSamples, zoomBuffer);
+
+  return zoomBuffer;
+}
+
+void AutoDopplerCorrect_impl::maskZoomSpectrum(FloatVector &spectrum) {
+  // Only search center +/- (max drift + expected width).  Past a quarter of
+  // the way out from the center the zoomed data may have aliases in it, so
+  // that's as far as it goes even if the drift was raised after startup.
+  int numBins = spectrum.size();
+  int centerBin = numBins / 2;
+  double hzPerBucket = d_sampleRate / (double)d_fftSize;
+  int halfBins = (int)ceil((d_maxDrift + d_expectedWidth) / hzPerBucket);
+
+  if (halfBins > numBins / 4)
+    halfBins = numBins / 4;
+
+  for (int i = 0; i < centerBin - halfBins; i++)
+    spectrum[i] = NOISE_FLOOR;
+
+  for (int i = centerBin + halfBins + 1; i < numBins; i++)
+    spectrum[i] = NOISE_FLOOR;
+}
+
 void AutoDopplerCorrect_impl::sendState(bool state) {
   int newState;
   if (state) {
@@ -236,6 +409,7 @@ void AutoDopplerCorrect_impl::handleMsgIn(pmt::pmt_t msg) {
         (SComplex *)volk_malloc(noutput_items * sizeof(SComplex), memAlignment);
   }
 
+  gr::thread::scoped_lock guard(d_mutex);
   int result =
       processData(noutput_items, cc_samples, pMsgOutBuff, &inputMetadata);
 }
@@ -289,14 +463,42 @@ void AutoDopplerCorrect_impl::sendMessageData(gr_complex *data, long datasize,
 int AutoDopplerCorrect_impl::processData(int noutput_items,
                                          const gr_complex *in, gr_complex *out,
                                          pmt::pmt_t *pMetadata, bool testMode) {
-  gr::thread::scoped_lock guard(d_mutex);
+  // Called with d_mutex held.  Only work() swaps in a new FFT size, so
+  // message data never changes the stream's block size.
+
 
   FloatVector maxSpectrum;
 
+  // In zoom mode the analyzer sees the decimated data.  Message data isn't
+  // part of the stream, so it runs through its own decimator starting from
+  // empty history and leaves the stream's history alone.
+  long analysisSamples = noutput_items;
+  double analysisRate = d_sampleRate / (double)d_zoomDecimation;
+  ZoomDecimator *pDecimator = pZoomDecimator;
+
+  if (pMetadata) {
+    pDecimator = pMsgZoomDecimator;
+
+    if (pDecimator)
+      pDecimator->reset();
+  }
+
+  const gr_complex *analysisIn = zoom(pDecimator, in, analysisSamples);
+
   // last boolean param indicates to use the squelch for values below the
   // configured squelch threshold.
-  long samplesProcessed =
-      pEnergyAnalyzer->maxHold(in, noutput_items, maxSpectrum, true);
+  // Message data has no stream position so it can't use a shared spectrum
+  long samplesProcessed;
+
+  if (pMetadata)
+    samplesProcessed = pEnergyAnalyzer->maxHold(analysisIn, analysisSamples,
+                                                maxSpectrum, true);
+  else
+    samplesProcessed = pEnergyAnalyzer->maxHold(
+        analysisIn, analysisSamples, nitems_read(0), maxSpectrum, true);
+
+  if (pZoomDecimator && (maxSpectrum.size() > 0))
+    maskZoomSpectrum(maxSpectrum);
 
 #ifdef PRINTDEBUG
   static int debugPrint = 300;
@@ -316,7 +518,7 @@ int AutoDopplerCorrect_impl::processData(int noutput_items,
   if (d_detectionMethod == AUTODOPPLER_METHOD_CLOSESTSIGNAL) {
     // Look for the closest signal
     numSignals = pEnergyAnalyzer->findSignals(
-        (const float *)&maxSpectrum[0], d_sampleRate, d_centerFreq,
+        (const float *)&maxSpectrum[0], analysisRate, d_centerFreq,
         d_minWidthHz, d_maxWidthHz, signalVector, false);
   } else {
     // This uses a boxing method, outside-in looking for a signal.
@@ -324,7 +526,7 @@ int AutoDopplerCorrect_impl::processData(int noutput_items,
 
     SignalOverview signalOverview;
     numSignals = pEnergyAnalyzer->findSingleSignal(
-        (const float *)&maxSpectrum[0], d_sampleRate, d_centerFreq,
+        (const float *)&maxSpectrum[0], analysisRate, d_centerFreq,
         d_minWidthHz, signalOverview);
 
     if (numSignals > 0) {
@@ -338,6 +540,7 @@ int AutoDopplerCorrect_impl::processData(int noutput_items,
   bool lostSignal = false;
   bool signalPresent = false;
   bool inHoldDown = false;
+  bool shiftUpdated = false;
   int closestIndex = 0;
   int closestDelta = 1.0e6;
   double curDelta;
@@ -359,6 +562,13 @@ int AutoDopplerCorrect_impl::processData(int noutput_items,
     }
   }
 
+  // Message data always gets messages, there's no stream to tag.
+  bool streamOutput = (pMetadata == NULL) && !testMode;
+  bool sendMessages = (pMetadata != NULL) ||
+                      (d_detectionOutput != DETECTION_OUTPUT_TAGS);
+  bool sendTags =
+      streamOutput && (d_detectionOutput != DETECTION_OUTPUT_MESSAGES);
+
   bool foundGoodSignal = false;
 
   for (int i = 0; i < signalVector.size(); i++) {
@@ -392,35 +602,39 @@ int AutoDopplerCorrect_impl::processData(int noutput_items,
 
       // send msg notification
       if (!pMetadata) {
-        pmt::pmt_t meta = pmt::make_dict();
-
-        // NOTE: freq matches the key looked for by the signal source block if
-        // needed.
-        meta = pmt::dict_add(meta, pmt::mp("numsignals"),
-                             pmt::mp((int)signalVector.size()));
-        meta = pmt::dict_add(meta, pmt::mp("decisionvalue"),
-                             pmt::mp((int)signalVector.size()));
-        meta = pmt::dict_add(meta, pmt::mp("closestsignalnum"),
-                             pmt::mp(closestIndex + 1));
-        meta = pmt::dict_add(meta, pmt::mp("freq"),
-                             pmt::mp(d_currentFreqShiftDelta));
-        meta = pmt::dict_add(meta, pmt::mp("freqoffset"),
-                             pmt::mp(d_currentFreqShiftDelta));
-        meta = pmt::dict_add(meta, pmt::mp("signalcenterfreq"),
-                             pmt::mp(signalVector[closestIndex].centerFreqHz));
-        meta = pmt::dict_add(meta, pmt::mp("trackingcenterfreq"),
-                             pmt::mp(signalVector[closestIndex].centerFreqHz));
-        meta = pmt::dict_add(meta, pmt::mp("widthHz"),
-                             pmt::mp(signalVector[closestIndex].widthHz));
-        meta = pmt::dict_add(meta, pmt::mp("signalpower"),
-                             pmt::mp(signalVector[closestIndex].maxPower));
-        pmt::pmt_t pdu = pmt::cons(meta, pmt::PMT_NIL);
-
         message_port_pub(pmt::mp("freq_shift"),
                          pmt::from_double(d_currentFreqShiftDelta));
 
-        if (!testMode)
-          message_port_pub(pmt::mp("freq_info"), pdu);
+        if (sendMessages) {
+          pmt::pmt_t meta = pmt::make_dict();
+
+          // NOTE: freq matches the key looked for by the signal source block if
+          // needed.
+          meta = pmt::dict_add(meta, pmt::mp("numsignals"),
+                               pmt::mp((int)signalVector.size()));
+          meta = pmt::dict_add(meta, pmt::mp("decisionvalue"),
+                               pmt::mp((int)signalVector.size()));
+          meta = pmt::dict_add(meta, pmt::mp("closestsignalnum"),
+                               pmt::mp(closestIndex + 1));
+          meta = pmt::dict_add(meta, pmt::mp("freq"),
+                               pmt::mp(d_currentFreqShiftDelta));
+          meta = pmt::dict_add(meta, pmt::mp("freqoffset"),
+                               pmt::mp(d_currentFreqShiftDelta));
+          meta =
+              pmt::dict_add(meta, pmt::mp("signalcenterfreq"),
+                            pmt::mp(signalVector[closestIndex].centerFreqHz));
+          meta =
+              pmt::dict_add(meta, pmt::mp("trackingcenterfreq"),
+                            pmt::mp(signalVector[closestIndex].centerFreqHz));
+          meta = pmt::dict_add(meta, pmt::mp("widthHz"),
+                               pmt::mp(signalVector[closestIndex].widthHz));
+          meta = pmt::dict_add(meta, pmt::mp("signalpower"),
+                               pmt::mp(signalVector[closestIndex].maxPower));
+          pmt::pmt_t pdu = pmt::cons(meta, pmt::PMT_NIL);
+
+          if (!testMode)
+            message_port_pub(pmt::mp("freq_info"), pdu);
+        }
       } else {
         *pMetadata = pmt::dict_add(*pMetadata, pmt::mp("numsignals"),
                                    pmt::mp((int)signalVector.size()));
@@ -512,39 +726,43 @@ int AutoDopplerCorrect_impl::processData(int noutput_items,
         d_currentFreqShiftDelta =
             d_centerFreq - signalVector[closestIndex].centerFreqHz;
         d_nco.set_freq(2 * M_PI * d_currentFreqShiftDelta / d_sampleRate);
+        shiftUpdated = true;
 
         if (!pMetadata) {
-          pmt::pmt_t meta = pmt::make_dict();
-
-          // NOTE: freq matches the key looked for by the signal source block if
-          // needed.
-          meta = pmt::dict_add(meta, pmt::mp("numsignals"),
-                               pmt::mp((int)signalVector.size()));
-          meta = pmt::dict_add(meta, pmt::mp("decisionvalue"),
-                               pmt::mp((int)signalVector.size()));
-          meta = pmt::dict_add(meta, pmt::mp("closestsignal"),
-                               pmt::mp(closestIndex + 1));
-          meta = pmt::dict_add(meta, pmt::mp("freq"),
-                               pmt::mp(d_currentFreqShiftDelta));
-          meta = pmt::dict_add(meta, pmt::mp("freqoffset"),
-                               pmt::mp(d_currentFreqShiftDelta));
-          meta =
-              pmt::dict_add(meta, pmt::mp("signalcenterfreq"),
-                            pmt::mp(signalVector[closestIndex].centerFreqHz));
-          meta =
-              pmt::dict_add(meta, pmt::mp("trackingcenterfreq"),
-                            pmt::mp(signalVector[closestIndex].centerFreqHz));
-          meta = pmt::dict_add(meta, pmt::mp("widthHz"),
-                               pmt::mp(signalVector[closestIndex].widthHz));
-          meta = pmt::dict_add(meta, pmt::mp("signalpower"),
-                               pmt::mp(signalVector[closestIndex].maxPower));
-
           message_port_pub(pmt::mp("freq_shift"),
                            pmt::from_double(d_currentFreqShiftDelta));
 
-          pmt::pmt_t pdu = pmt::cons(meta, pmt::PMT_NIL);
-          if (!testMode)
-            message_port_pub(pmt::mp("freq_info"), pdu);
+          if (sendMessages) {
+            pmt::pmt_t meta = pmt::make_dict();
+
+            // NOTE: freq matches the key looked for by the signal source block
+            // if needed.
+            meta = pmt::dict_add(meta, pmt::mp("numsignals"),
+                                 pmt::mp((int)signalVector.size()));
+            meta = pmt::dict_add(meta, pmt::mp("decisionvalue"),
+                                 pmt::mp((int)signalVector.size()));
+            meta = pmt::dict_add(meta, pmt::mp("closestsignal"),
+                                 pmt::mp(closestIndex + 1));
+            meta = pmt::dict_add(meta, pmt::mp("freq"),
+                                 pmt::mp(d_currentFreqShiftDelta));
+            meta = pmt::dict_add(meta, pmt::mp("freqoffset"),
+                                 pmt::mp(d_currentFreqShiftDelta));
+            meta =
+                pmt::dict_add(meta, pmt::mp("signalcenterfreq"),
+                              pmt::mp(signalVector[closestIndex].centerFreqHz));
+            meta =
+                pmt::dict_add(meta, pmt::mp("trackingcenterfreq"),
+                              pmt::mp(signalVector[closestIndex].centerFreqHz));
+            meta = pmt::dict_add(meta, pmt::mp("widthHz"),
+                                 pmt::mp(signalVector[closestIndex].widthHz));
+            meta = pmt::dict_add(meta, pmt::mp("signalpower"),
+                                 pmt::mp(signalVector[closestIndex].maxPower));
+
+            pmt::pmt_t pdu = pmt::cons(meta, pmt::PMT_NIL);
+
+            if (!testMode)
+              message_port_pub(pmt::mp("freq_info"), pdu);
+          }
         } else {
           *pMetadata = pmt::dict_add(*pMetadata, pmt::mp("numsignals"),
                                      pmt::mp((int)signalVector.size()));
@@ -623,6 +841,48 @@ int AutoDopplerCorrect_impl::processData(int noutput_items,
                     signalVector[closestIndex].maxPower, pMetadata);
   // ---------------------------------------------------------------------------
 
+  // Stream tags.  Detection goes at the start of the first frame with energy
+  // over the squelch, everything else at the start of this block.
+  if (sendTags) {
+    uint64_t writeStart = nitems_written(0);
+
+    if (justDetectedSignal) {
+      long activeOffset = 0;
+      long activeFrame = pEnergyAnalyzer->getFirstActiveFrame();
+
+      // A zoomed frame still spans d_fftSize input samples
+      if (activeFrame > 0)
+        activeOffset = activeFrame * d_fftSize;
+
+      if (activeOffset >= noutput_items)
+        activeOffset = 0;
+
+      uint64_t offset = writeStart + activeOffset;
+      const SignalOverview &closest = signalVector[closestIndex];
+
+      add_item_tag(0, offset, tagKeys.detect, pmt::PMT_T);
+      add_item_tag(0, offset, tagKeys.numSignals,
+                   pmt::from_long(signalVector.size()));
+      add_item_tag(0, offset, tagKeys.signalCenterFreq,
+                   pmt::from_double(closest.centerFreqHz));
+      add_item_tag(0, offset, tagKeys.widthHz,
+                   pmt::from_double(closest.widthHz));
+      add_item_tag(0, offset, tagKeys.maxPower,
+                   pmt::from_float(closest.maxPower));
+      add_item_tag(0, offset, tagKeys.freqOffset,
+                   pmt::from_double(d_currentFreqShiftDelta));
+    } else if (shiftUpdated) {
+      add_item_tag(0, writeStart, tagKeys.freqOffset,
+                   pmt::from_double(d_currentFreqShiftDelta));
+    }
+
+    if (lostSignal) {
+      add_item_tag(0, writeStart, tagKeys.detect, pmt::PMT_F);
+      add_item_tag(0, writeStart, tagKeys.freqOffset,
+                   pmt::from_double(d_currentFreqShiftDelta));
+    }
+  }
+
   // PDU Output:
   // signalState:
   // 1 - Signal just acquired
@@ -630,7 +890,7 @@ int AutoDopplerCorrect_impl::processData(int noutput_items,
   //
 
   // If just detected signal, send new PDU
-  if (justDetectedSignal) {
+  if (justDetectedSignal && sendMessages) {
     pmt::pmt_t meta = pmt::make_dict();
 
     meta = pmt::dict_add(meta, pmt::mp("state"), pmt::mp(1));
@@ -648,7 +908,7 @@ int AutoDopplerCorrect_impl::processData(int noutput_items,
     sendState(true);
   }
   // if Just lost signal, send PDU
-  if (lostSignal) {
+  if (lostSignal && sendMessages) {
     pmt::pmt_t meta = pmt::make_dict();
     meta = pmt::dict_add(meta, pmt::mp("state"), pmt::mp(0));
     meta = pmt::dict_add(meta, pmt::mp("decisionvalue"), pmt::mp(0));
@@ -672,6 +932,11 @@ int AutoDopplerCorrect_impl::work(int noutput_items,
   const gr_complex *in = (const gr_complex *)input_items[0];
   gr_complex *out = (gr_complex *)output_items[0];
 
+  gr::thread::scoped_lock guard(d_mutex);
+
+  // Pick up a new FFT size or window if one's ready
+  applyReconfig();
+
   return processData(noutput_items, in, out, NULL);
 }
 
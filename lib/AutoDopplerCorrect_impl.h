@@ -21,6 +21,7 @@
 #ifndef INCLUDED_MESA_AUTODOPPLERCORRECT_IMPL_H
 #define INCLUDED_MESA_AUTODOPPLERCORRECT_IMPL_H
 
+#include "detection_tags_mesa.h"
 #include "signals_mesa.h"
 #include <chrono>
 #include <ctime>
@@ -64,6 +65,34 @@ protected:
 
   double d_currentFreqShiftDelta;
 
+  int d_detectionOutput;
+  const DetectionTagKeys &tagKeys;
+
+  // Runtime FFT size / window changes.  d_blockSize is the analysis block
+  // size the flowgraph's buffers were sized for at startup.  Later FFT sizes
+  // average as many frames as fit in it.
+  AnalyzerReconfig analyzerReconfig;
+  int d_blockSize;
+  int d_requestedFFTSize;
+  int d_windowType;
+  void applyReconfig();
+
+  // Zoom analysis: the input is low pass filtered and decimated by
+  // d_zoomDecimation so a d_fftSize / d_zoomDecimation FFT covers just the
+  // middle of the band at the same bin spacing.  d_zoomDecimation is 1 (and
+  // pZoomDecimator NULL) when it's off.  Message data gets its own
+  // decimator so it doesn't disturb the stream's filter history.
+  ZoomDecimator *pZoomDecimator;
+  ZoomDecimator *pMsgZoomDecimator;
+  int d_zoomDecimation;
+  gr_complex *zoomBuffer;
+  long zoomBufferSize;
+
+  const gr_complex *zoom(ZoomDecimator *pDecimator, const gr_complex *in,
+                         long &numSamples);
+  void maskZoomSpectrum(FloatVector &spectrum);
+  float calcMinDutyCycle();
+
   std::chrono::time_point<std::chrono::steady_clock> lastSeen, lastShifted;
 
   virtual void sendMessageData(gr_complex *data, long datasize,
@@ -77,12 +106,16 @@ public:
                           int shiftHolddownMS, int fft_size,
                           float squelchThreshold, int framesToAvg,
                           float holdUpSec, bool processMessages,
-                          int detectionMethod);
+                          int detectionMethod, int analyzeFrames,
+                          int frameStride, bool adaptiveAnalysis,
+                          const std::string &sharedSpectrum,
+                          int detectionOutput, int windowType,
+                          bool zoomAnalysis);
   ~AutoDopplerCorrect_impl();
 
   virtual bool stop();
 
-  // Needed to be public for debug testing
+  // Needed to be public for debug testing.  Caller must hold d_mutex.
   virtual int processData(int noutput_items, const gr_complex *in,
                           gr_complex *out, pmt::pmt_t *pMetadata,
                           bool testMode = false);
@@ -105,6 +138,12 @@ public:
   virtual double getExpectedWidth() const;
   virtual void setExpectedWidth(double newValue);
 
+  virtual int getFFTSize() const;
+  virtual void setFFTSize(int newValue);
+
+  virtual int getWindowType() const;
+  virtual void setWindowType(int newValue);
+
   virtual double getMaxDrift() const;
   virtual void setMaxDrift(double newValue);
 };
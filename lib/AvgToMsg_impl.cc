@@ -30,22 +30,40 @@
 namespace gr {
 namespace mesa {
 
-AvgToMsg::sptr AvgToMsg::make(int veclen) {
-  return gnuradio::get_initial_sptr(new AvgToMsg_impl(veclen));
+AvgToMsg::sptr AvgToMsg::make(int veclen, int reportInterval, int avgType,
+                              int intervalUnits) {
+  return gnuradio::get_initial_sptr(
+      new AvgToMsg_impl(veclen, reportInterval, avgType, intervalUnits));
 }
 
 /*
  * The private constructor
  */
-AvgToMsg_impl::AvgToMsg_impl(int veclen)
+AvgToMsg_impl::AvgToMsg_impl(int veclen, int reportInterval, int avgType,
+                             int intervalUnits)
     : gr::sync_block("AvgToMsg",
                      gr::io_signature::make(1, 1, sizeof(float) * veclen),
-                     gr::io_signature::make(0, 0, 0)) {
+                     gr::io_signature::make(0, 0, 0)),
+      lowPercentile(0.05), median(0.5), highPercentile(0.95) {
   d_veclen = veclen;
   b_hold = false;
-  b_useStdDev = true;
+  d_avgType = avgType;
+
+  if ((intervalUnits < AVGTOMSG_UNITS_VECTORS) ||
+      (intervalUnits > AVGTOMSG_UNITS_SAMPLES)) {
+    throw std::out_of_range("[AvgToMsg] Unknown report interval units");
+  }
+
+  d_intervalUnits = intervalUnits;
+
+  // Until start() knows whether the stats port is connected
+  d_fullStats = true;
+
+  setReportInterval(reportInterval);
+  resetStats();
 
   message_port_register_out(pmt::mp("avg"));
+  message_port_register_out(pmt::mp("stats"));
 }
 
 /*
@@ -53,48 +71,132 @@ AvgToMsg_impl::AvgToMsg_impl(int veclen)
  */
 AvgToMsg_impl::~AvgToMsg_impl() {}
 
+bool AvgToMsg_impl::start() {
+  // Connections are fixed once the flowgraph is running
+  d_fullStats = !pmt::is_null(message_subscribers(pmt::mp("stats")));
+  resetStats();
+
+  return gr::sync_block::start();
+}
+
+int AvgToMsg_impl::getReportInterval() const { return d_reportInterval; }
+
+void AvgToMsg_impl::setReportInterval(int newValue) {
+  // 0 reports on every block of samples received
+  if (newValue < 0)
+    newValue = 0;
+
+  d_reportInterval = newValue;
+
+  if (d_intervalUnits == AVGTOMSG_UNITS_VECTORS)
+    intervalSamples = (long)d_reportInterval * d_veclen;
+  else
+    intervalSamples = d_reportInterval;
+}
+
+void AvgToMsg_impl::resetStats() {
+  stats.reset();
+  lowPercentile.reset();
+  median.reset();
+  highPercentile.reset();
+  meanSum = 0.0;
+  samplesCollected = 0;
+}
+
+void AvgToMsg_impl::addValues(const float *values, long numValues) {
+  if (d_fullStats) {
+    // One pass: every stat is updated from the same read of each value
+    for (long i = 0; i < numValues; i++) {
+      float value = values[i];
+
+      stats.add(value);
+      lowPercentile.add(value);
+      median.add(value);
+      highPercentile.add(value);
+    }
+  } else if (d_avgType == AVGTOMSG_MEDIAN) {
+    for (long i = 0; i < numValues; i++)
+      median.add(values[i]);
+  } else {
+    float sum;
+    volk_32f_accumulator_s32f(&sum, values, numValues);
+    meanSum += sum;
+  }
+
+  samplesCollected += numValues;
+}
+
+void AvgToMsg_impl::sendStats() {
+  float avg;
+
+  // The median is the robust option.  A few big outliers won't drag it
+  // around the way they do the mean.
+  if (d_avgType == AVGTOMSG_MEDIAN)
+    avg = median.getValue();
+  else if (d_fullStats)
+    avg = stats.getMean();
+  else
+    avg = meanSum / (double)samplesCollected;
+
+  message_port_pub(pmt::mp("avg"), pmt::from_float(avg));
+
+  if (!d_fullStats)
+    return;
+
+  pmt::pmt_t meta = pmt::make_dict();
+  meta = pmt::dict_add(meta, pmt::mp("count"), pmt::mp(stats.getCount()));
+  meta = pmt::dict_add(meta, pmt::mp("mean"), pmt::mp(stats.getMean()));
+  meta =
+      pmt::dict_add(meta, pmt::mp("variance"), pmt::mp(stats.getVariance()));
+  meta = pmt::dict_add(meta, pmt::mp("stddev"), pmt::mp(stats.getStdDev()));
+  meta = pmt::dict_add(meta, pmt::mp("min"), pmt::mp(stats.getMin()));
+  meta = pmt::dict_add(meta, pmt::mp("max"), pmt::mp(stats.getMax()));
+  meta = pmt::dict_add(meta, pmt::mp("p05"),
+                       pmt::mp(lowPercentile.getValue()));
+  meta = pmt::dict_add(meta, pmt::mp("median"), pmt::mp(median.getValue()));
+  meta = pmt::dict_add(meta, pmt::mp("p95"),
+                       pmt::mp(highPercentile.getValue()));
+
+  pmt::pmt_t pdu = pmt::cons(meta, pmt::PMT_NIL);
+
+  message_port_pub(pmt::mp("stats"), pdu);
+}
+
 int AvgToMsg_impl::work(int noutput_items,
                         gr_vector_const_void_star &input_items,
                         gr_vector_void_star &output_items) {
   const float *in = (const float *)input_items[0];
 
-  float sum = 0.0;
-  int vecstart;
-  long nitems = d_veclen * noutput_items;
+  long numValues = (long)noutput_items * d_veclen;
+  long curValue = 0;
 
-  volk_32f_accumulator_s32f(&sum, in, nitems);
+  while (curValue < numValues) {
+    // Stop at the next report boundary, which can fall inside a vector when
+    // the interval is in samples.
+    long chunk = numValues - curValue;
 
-  float avg = sum / (d_veclen * noutput_items);
+    if ((intervalSamples > 0) &&
+        (chunk > intervalSamples - samplesCollected))
+      chunk = intervalSamples - samplesCollected;
 
-  /*
-  if (b_useStdDev) {
-      // include in result only if value is within 2 std_dev (98% of all samples
-  should fall here) float standardDeviation = 0.0; for(long i = 0; i < nitems;
-  ++i) { standardDeviation += pow(in[i] - avg, 2);
-      }
-      standardDeviation = sqrt(standardDeviation / (float)nitems);
+    addValues(&in[curValue], chunk);
+    curValue += chunk;
 
-      float TwoStdDev = 2.0*standardDeviation;
+    if ((intervalSamples > 0) && (samplesCollected >= intervalSamples)) {
+      if (!b_hold)
+        sendStats();
 
-      long itemsUsed = 0;
-      float newSum = 0.0;
-
-      for(long i = 0; i < nitems; ++i) {
-              if (fabs(in[i] - avg) <= TwoStdDev) {
-                      itemsUsed++;
-                      newSum += in[i];
-              }
-      }
+      resetStats();
+    }
+  }
 
-      if (itemsUsed > 0) {
-              avg = newSum / (float)itemsUsed;
-      }
+  if ((intervalSamples == 0) && (samplesCollected > 0)) {
+    // Report on every block we're handed
+    if (!b_hold)
+      sendStats();
 
+    resetStats();
   }
-      */
-
-  if (!b_hold)
-    message_port_pub(pmt::mp("avg"), pmt::from_float(avg));
 
   // Tell runtime system how many output items we produced.
   return noutput_items;
@@ -21,8 +21,19 @@
 #ifndef INCLUDED_MESA_AVGTOMSG_IMPL_H
 #define INCLUDED_MESA_AVGTOMSG_IMPL_H
 
+#include "stats_mesa.h"
 #include <mesa/AvgToMsg.h>
 
+using namespace MesaSignals;
+
+// What goes out the avg port
+#define AVGTOMSG_MEAN 1
+#define AVGTOMSG_MEDIAN 2
+
+// What the report interval counts
+#define AVGTOMSG_UNITS_VECTORS 1
+#define AVGTOMSG_UNITS_SAMPLES 2
+
 namespace gr {
 namespace mesa {
 
@@ -30,16 +41,42 @@ class AvgToMsg_impl : public AvgToMsg {
 private:
   int d_veclen;
   bool b_hold;
-  bool b_useStdDev;
+  int d_reportInterval;
+  int d_avgType;
+  int d_intervalUnits;
+
+  // Report interval converted to samples (0 = every block)
+  long intervalSamples;
+
+  // Everything is gathered in a single pass over the input.  The full set
+  // is only kept when the stats port is connected.  Otherwise just what the
+  // avg port needs is: a plain sum for the mean or the median estimate.
+  bool d_fullStats;
+  RunningStats stats;
+  P2Quantile lowPercentile;
+  P2Quantile median;
+  P2Quantile highPercentile;
+  double meanSum;
+  long samplesCollected;
+
+  void addValues(const float *values, long numValues);
+  void resetStats();
+  void sendStats();
 
 public:
-  AvgToMsg_impl(int veclen);
+  AvgToMsg_impl(int veclen, int reportInterval, int avgType,
+                int intervalUnits);
   ~AvgToMsg_impl();
 
+  bool start();
+
   void setup_rpc();
 
   virtual void setHold(bool newValue);
 
+  virtual int getReportInterval() const;
+  virtual void setReportInterval(int newValue);
+
   // Where all the action really happens
   int work(int noutput_items, gr_vector_const_void_star &input_items,
            gr_vector_void_star &output_items);
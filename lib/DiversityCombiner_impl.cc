@@ -0,0 +1,208 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2019 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "DiversityCombiner_impl.h"
+#include <gnuradio/io_signature.h>
+#include <volk/volk.h>
+
+namespace gr {
+namespace mesa {
+
+DiversityCombiner::sptr DiversityCombiner::make(int numInputs, int fft_size,
+                                                int framesToAvg,
+                                                float weightAlpha) {
+  return gnuradio::get_initial_sptr(new DiversityCombiner_impl(
+      numInputs, fft_size, framesToAvg, weightAlpha));
+}
+
+/*
+ * The private constructor
+ */
+DiversityCombiner_impl::DiversityCombiner_impl(int numInputs, int fft_size,
+                                               int framesToAvg,
+                                               float weightAlpha)
+    : gr::sync_block("DiversityCombiner",
+                     gr::io_signature::make(numInputs, numInputs,
+                                            sizeof(gr_complex)),
+                     gr::io_signature::make(1, 1, sizeof(gr_complex))) {
+  d_numInputs = numInputs;
+  d_fftSize = fft_size;
+  d_framesToAvg = framesToAvg;
+
+  if (d_framesToAvg < 1)
+    d_framesToAvg = 1;
+
+  setWeightAlpha(weightAlpha);
+
+  // No squelch.  We want the noise floor in the spectrum to estimate SNR.
+  for (int i = 0; i < d_numInputs; i++)
+    energyAnalyzers.push_back(
+        new EnergyAnalyzer(d_fftSize, SQUELCH_DISABLE, 0.0));
+
+  // Start out with all inputs weighted equally
+  weights.assign(d_numInputs, 1.0 / (float)d_numInputs);
+  weightsInitialized = false;
+
+  tmpBuffer = NULL;
+  tmpBufferSize = 0;
+
+  gr::block::set_output_multiple(d_fftSize * d_framesToAvg);
+}
+
+/*
+ * Our virtual destructor.
+ */
+DiversityCombiner_impl::~DiversityCombiner_impl() { bool retVal = stop(); }
+
+bool DiversityCombiner_impl::stop() {
+  for (int i = 0; i < energyAnalyzers.size(); i++) {
+    if (energyAnalyzers[i]) {
+      delete energyAnalyzers[i];
+      energyAnalyzers[i] = NULL;
+    }
+  }
+
+  if (tmpBuffer) {
+    volk_free(tmpBuffer);
+    tmpBuffer = NULL;
+    tmpBufferSize = 0;
+  }
+
+  return true;
+}
+
+float DiversityCombiner_impl::getWeightAlpha() const { return d_weightAlpha; }
+
+void DiversityCombiner_impl::setWeightAlpha(float newValue) {
+  // alpha of 1.0 means no smoothing, just use the latest estimate
+  if (newValue <= 0.0 || newValue > 1.0)
+    newValue = 1.0;
+
+  d_weightAlpha = newValue;
+}
+
+void DiversityCombiner_impl::updateWeights(
+    int noutput_items, gr_vector_const_void_star &input_items) {
+  // MRC weights each input by h*/N.  With |h|^2 = SNR * N that works out to
+  // a magnitude of sqrt(SNR / N).  SNR here is the max-hold peak over the
+  // average of the spectrum, and N is that average.
+  FloatVector maxSpectrum;
+  std::vector<float> newWeights(d_numInputs);
+  float totalWeight = 0.0;
+  float dutyCycle, maxPower, minPower, centerAvgPower, avgPower;
+
+  for (int i = 0; i < d_numInputs; i++) {
+    const gr_complex *in = (const gr_complex *)input_items[i];
+
+    energyAnalyzers[i]->maxHold(in, noutput_items, maxSpectrum, false);
+    energyAnalyzers[i]->analyzeSpectrum(&maxSpectrum[0], dutyCycle, maxPower,
+                                        minPower, centerAvgPower, avgPower);
+
+    float snr = powf(10.0, (maxPower - avgPower) / 10.0);
+    float noise = powf(10.0, avgPower / 10.0);
+
+    if (noise > 0.0)
+      newWeights[i] = sqrtf(snr / noise);
+    else
+      newWeights[i] = 0.0;
+
+    totalWeight += newWeights[i];
+  }
+
+  if (totalWeight <= 0.0)
+    return;
+
+  // Normalize so the weights sum to 1 and the output level stays put, then
+  // smooth so the weights don't jump around frame to frame.
+  for (int i = 0; i < d_numInputs; i++) {
+    newWeights[i] = newWeights[i] / totalWeight;
+
+    if (weightsInitialized)
+      weights[i] =
+          d_weightAlpha * newWeights[i] + (1.0 - d_weightAlpha) * weights[i];
+    else
+      weights[i] = newWeights[i];
+  }
+
+  weightsInitialized = true;
+}
+
+int DiversityCombiner_impl::work(int noutput_items,
+                                 gr_vector_const_void_star &input_items,
+                                 gr_vector_void_star &output_items) {
+  gr_complex *out = (gr_complex *)output_items[0];
+
+  if (noutput_items > tmpBufferSize) {
+    if (tmpBuffer)
+      volk_free(tmpBuffer);
+
+    size_t memAlignment = volk_get_alignment();
+    tmpBuffer = (gr_complex *)volk_malloc(noutput_items * sizeof(gr_complex),
+                                          memAlignment);
+    tmpBufferSize = noutput_items;
+  }
+
+  updateWeights(noutput_items, input_items);
+
+  // Everything gets phase-aligned to the strongest input
+  int refIndex = 0;
+
+  for (int i = 1; i < d_numInputs; i++) {
+    if (weights[i] > weights[refIndex])
+      refIndex = i;
+  }
+
+  const gr_complex *ref = (const gr_complex *)input_items[refIndex];
+
+  volk_32fc_s32fc_multiply_32fc(out, ref, gr_complex(weights[refIndex], 0.0),
+                                noutput_items);
+
+  for (int i = 0; i < d_numInputs; i++) {
+    if (i == refIndex)
+      continue;
+
+    const gr_complex *in = (const gr_complex *)input_items[i];
+
+    // sum(ref * conj(in)) has the phase of ref relative to in, so rotating
+    // in by it lines the two up.
+    gr_complex phaseDiff;
+    volk_32fc_x2_conjugate_dot_prod_32fc(&phaseDiff, ref, in, noutput_items);
+
+    float mag = std::abs(phaseDiff);
+    gr_complex rotation(1.0, 0.0);
+
+    if (mag > 0.0)
+      rotation = phaseDiff / mag;
+
+    volk_32fc_s32fc_multiply_32fc(tmpBuffer, in, rotation * weights[i],
+                                  noutput_items);
+    volk_32fc_x2_add_32fc(out, out, tmpBuffer, noutput_items);
+  }
+
+  // Tell runtime system how many output items we produced.
+  return noutput_items;
+}
+
+} /* namespace mesa */
+} /* namespace gr */
@@ -23,107 +23,370 @@
 #endif
 
 #include "LongTermIntegrator_impl.h"
+#include <cstdio>
+#include <fcntl.h>
 #include <gnuradio/io_signature.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <volk/volk.h>
 
 namespace gr {
 namespace mesa {
 
-LongTermIntegrator::sptr LongTermIntegrator::make(int fftsize, bool normalize) {
-  return gnuradio::get_initial_sptr(
-      new LongTermIntegrator_impl(fftsize, normalize));
+// Checkpoint file layout: this header followed by the fftsize doubles of
+// the aggregation buffer and, for sliding mode, the window of input vectors.
+#define LTI_CHECKPOINT_MAGIC "MESALTI1"
+
+struct LTICheckpointHeader {
+  char magic[8];
+  int32_t fftsize;
+  int32_t integrationMode;
+  int32_t integrationLength;
+  int32_t reserved;
+  int64_t windowIndex;
+  int64_t windowCount;
+  uint64_t vectorsIntegrated;
+  double elapsedSeconds;
+};
+
+LongTermIntegrator::sptr LongTermIntegrator::make(int fftsize, bool normalize,
+                                                  int integrationMode,
+                                                  int integrationLength,
+                                                  const std::string &checkpointFile,
+                                                  float snapshotPeriodSec) {
+  return gnuradio::get_initial_sptr(new LongTermIntegrator_impl(
+      fftsize, normalize, integrationMode, integrationLength, checkpointFile,
+      snapshotPeriodSec));
 }
 
 /*
  * The private constructor
  */
-LongTermIntegrator_impl::LongTermIntegrator_impl(int fftsize, bool normalize)
+LongTermIntegrator_impl::LongTermIntegrator_impl(int fftsize, bool normalize,
+                                                 int integrationMode,
+                                                 int integrationLength,
+                                                 const std::string &checkpointFile,
+                                                 float snapshotPeriodSec)
     : gr::sync_block("LongTermIntegrator",
                      gr::io_signature::make(1, 1, sizeof(float) * fftsize),
                      gr::io_signature::make(1, 1, sizeof(float) * fftsize)) {
   d_fftsize = fftsize;
   d_normalize = normalize;
+  d_integrationMode = integrationMode;
+  d_integrationLength = integrationLength;
+
+  if ((d_integrationMode != LTI_MODE_CUMULATIVE) && (d_integrationLength < 1))
+    throw std::out_of_range("[LongTermIntegrator] Sliding and exponential "
+                            "modes need an integration length of at least "
+                            "1 vector.");
 
   size_t memAlignment = volk_get_alignment();
-  aggBuffer = (float *)volk_malloc(fftsize * sizeof(float), memAlignment);
-  for (int i = 0; i < d_fftsize; i++)
-    aggBuffer[i] = 0.0;
+  aggBuffer = (double *)volk_malloc(fftsize * sizeof(double), memAlignment);
+
+  windowBuffer = NULL;
+  writerThread = NULL;
+  writerBusy.store(false);
+  windowIndex = 0;
+  windowCount = 0;
+
+  if (d_integrationMode == LTI_MODE_SLIDING)
+    windowBuffer = (float *)volk_malloc(
+        (size_t)d_integrationLength * fftsize * sizeof(float), memAlignment);
+
+  // Exponential mode uses the integration length as the time constant in
+  // vectors.  In steady state that gives the same total as a sliding window
+  // of the same length.
+  decayFactor = 1.0;
+
+  if (d_integrationMode == LTI_MODE_EXPONENTIAL)
+    decayFactor = 1.0 - 1.0 / (double)d_integrationLength;
+
+  clearIntegration();
 
   startTime = std::chrono::steady_clock::now();
 
-  threadRunning = false;
-  stopThread = false;
-  readThread =
-      new boost::thread(boost::bind(&LongTermIntegrator_impl::runThread, this));
+  // Pick up where we left off if there's a checkpoint.
+  d_checkpointFile = checkpointFile;
+  d_snapshotPeriodSec = snapshotPeriodSec;
+
+  if (d_checkpointFile.length() > 0)
+    loadCheckpoint();
+
+  lastSnapshot = std::chrono::steady_clock::now();
+
+  // Report right away on the first work() call, then every interval.
+  lastReport = startTime;
+  reportPending = true;
 
   message_port_register_out(pmt::mp("runtime"));
+
+  message_port_register_in(pmt::mp("snapshot"));
+  set_msg_handler(pmt::mp("snapshot"),
+                  [this](pmt::pmt_t msg) { this->handleSnapshotMsg(msg); });
 }
 
-void LongTermIntegrator_impl::runThread() {
-  threadRunning = true;
-  int loopCount = 0;
-  int maxLoop = 5 / 0.01; // 5 seconds
+void LongTermIntegrator_impl::sendRuntime(
+    const std::chrono::time_point<std::chrono::steady_clock> &curTimestamp) {
+  // Runtime reporting is driven from work() rather than a polling thread.
+  // The message is a PDU whose metadata carries the integration time in
+  // seconds and the number of vectors integrated so downstream blocks
+  // don't have to parse a string.
+  std::chrono::duration<double> elapsed_seconds = curTimestamp - startTime;
 
-  usleep(10000); // let primary thread start.
-  startTime = std::chrono::steady_clock::now();
+  pmt::pmt_t meta = pmt::make_dict();
+  meta = pmt::dict_add(meta, pmt::mp("seconds"),
+                       pmt::from_double(elapsed_seconds.count()));
+  meta = pmt::dict_add(meta, pmt::mp("vectorsIntegrated"),
+                       pmt::from_uint64(vectorsIntegrated));
 
-  while (!stopThread) {
-    std::chrono::time_point<std::chrono::steady_clock> curTimestamp =
-        std::chrono::steady_clock::now();
-    std::chrono::duration<double> elapsed_seconds;
-
-    elapsed_seconds = curTimestamp - startTime;
-
-    float sec = elapsed_seconds.count();
-    stringstream stream;
-    string timeStr;
-    if (sec < 60.0) {
-      stream << std::fixed << std::setprecision(2) << sec;
-      timeStr = stream.str() + " seconds";
-    } else {
-      stream << std::fixed << std::setprecision(2) << (sec / 60.0);
-      timeStr = stream.str() + " minutes";
-    }
+  pmt::pmt_t pdu = pmt::cons(meta, pmt::PMT_NIL);
 
-    // std::cout << "Sending " << timeStr << std::endl;
+  message_port_pub(pmt::mp("runtime"), pdu);
 
-    message_port_pub(pmt::mp("runtime"), pmt::intern(timeStr));
+  lastReport = curTimestamp;
+  reportPending = false;
+}
 
-    loopCount = 0;
+void LongTermIntegrator_impl::clearIntegration() {
+  // Zero out all aggregation buckets
+  memset(aggBuffer, 0x00, d_fftsize * sizeof(double));
 
-    while (!stopThread && loopCount < maxLoop) {
-      // check increment
-      usleep(10000); // sleep 10 millisec
-      loopCount++;
-    }
+  windowIndex = 0;
+  windowCount = 0;
+  vectorsIntegrated = 0;
+}
+
+void LongTermIntegrator_impl::copyCheckpoint() {
+  // Caller holds d_mutex.
+  size_t aggBytes = d_fftsize * sizeof(double);
+  size_t windowBytes = 0;
+
+  if (windowBuffer)
+    windowBytes = (size_t)d_integrationLength * d_fftsize * sizeof(float);
+
+  // Same size every time, so this only allocates on the first snapshot
+  checkpointData.resize(sizeof(LTICheckpointHeader) + aggBytes + windowBytes);
+
+  std::chrono::duration<double> elapsed_seconds =
+      std::chrono::steady_clock::now() - startTime;
+
+  LTICheckpointHeader header;
+  memset(&header, 0x00, sizeof(header));
+  memcpy(header.magic, LTI_CHECKPOINT_MAGIC, sizeof(header.magic));
+  header.fftsize = d_fftsize;
+  header.integrationMode = d_integrationMode;
+  header.integrationLength = d_integrationLength;
+  header.windowIndex = windowIndex;
+  header.windowCount = windowCount;
+  header.vectorsIntegrated = vectorsIntegrated;
+  header.elapsedSeconds = elapsed_seconds.count();
+
+  char *pData = &checkpointData[0];
+  memcpy(pData, &header, sizeof(header));
+  memcpy(&pData[sizeof(header)], aggBuffer, aggBytes);
+
+  if (windowBytes > 0)
+    memcpy(&pData[sizeof(header) + aggBytes], windowBuffer, windowBytes);
+}
+
+bool LongTermIntegrator_impl::writeCheckpoint() {
+  // Writes checkpointData.  The snapshot is written to a temp file through a
+  // memory map then renamed over the checkpoint so a crash mid-write never
+  // leaves a partial file.
+  size_t fileSize = checkpointData.size();
+
+  if ((d_checkpointFile.length() == 0) || (fileSize == 0))
+    return false;
+
+  std::string tmpFile = d_checkpointFile + ".tmp";
+
+  int fd = open(tmpFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0) {
+    std::cout << "[LongTermIntegrator] Unable to open checkpoint file "
+              << tmpFile << std::endl;
+    return false;
+  }
+
+  if (ftruncate(fd, fileSize) != 0) {
+    close(fd);
+    unlink(tmpFile.c_str());
+    return false;
+  }
+
+  char *pMap =
+      (char *)mmap(NULL, fileSize, PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (pMap == MAP_FAILED) {
+    close(fd);
+    unlink(tmpFile.c_str());
+    return false;
   }
 
-  threadRunning = false;
+  memcpy(pMap, &checkpointData[0], fileSize);
+
+  bool success = (msync(pMap, fileSize, MS_SYNC) == 0);
+
+  munmap(pMap, fileSize);
+  close(fd);
+
+  if (success)
+    success = (rename(tmpFile.c_str(), d_checkpointFile.c_str()) == 0);
+
+  if (!success) {
+    std::cout << "[LongTermIntegrator] Unable to write checkpoint file "
+              << d_checkpointFile << std::endl;
+    unlink(tmpFile.c_str());
+  }
+
+  return success;
+}
+
+bool LongTermIntegrator_impl::startCheckpoint() {
+  // Caller holds d_mutex.  Copies the current state and hands it to the
+  // writer thread.  If the last checkpoint is still being written, this one
+  // is skipped rather than waiting on it.
+  if (d_checkpointFile.length() == 0)
+    return false;
+
+  if (writerBusy.load(std::memory_order_acquire))
+    return false;
+
+  // The last writer is done, this just cleans it up.
+  waitForCheckpoint();
+
+  copyCheckpoint();
+
+  writerBusy.store(true, std::memory_order_release);
+  writerThread = new boost::thread([this]() {
+    this->writeCheckpoint();
+    this->writerBusy.store(false, std::memory_order_release);
+  });
+
+  return true;
+}
+
+void LongTermIntegrator_impl::waitForCheckpoint() {
+  if (writerThread) {
+    writerThread->join();
+    delete writerThread;
+    writerThread = NULL;
+  }
+}
+
+bool LongTermIntegrator_impl::loadCheckpoint() {
+  int fd = open(d_checkpointFile.c_str(), O_RDONLY);
+
+  if (fd < 0) {
+    // Nothing saved yet.  We'll start fresh.
+    return false;
+  }
+
+  struct stat fileStat;
+
+  if ((fstat(fd, &fileStat) != 0) ||
+      (fileStat.st_size < (off_t)sizeof(LTICheckpointHeader))) {
+    close(fd);
+    return false;
+  }
+
+  size_t fileSize = fileStat.st_size;
+
+  const char *pMap =
+      (const char *)mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+
+  close(fd);
+
+  if (pMap == MAP_FAILED)
+    return false;
+
+  LTICheckpointHeader header;
+  memcpy(&header, pMap, sizeof(header));
+
+  size_t aggBytes = d_fftsize * sizeof(double);
+  size_t windowBytes = 0;
+
+  if (windowBuffer)
+    windowBytes = (size_t)d_integrationLength * d_fftsize * sizeof(float);
+
+  // Only resume if the checkpoint matches how we're configured now.
+  bool valid =
+      (memcmp(header.magic, LTI_CHECKPOINT_MAGIC, sizeof(header.magic)) ==
+       0) &&
+      (header.fftsize == d_fftsize) &&
+      (header.integrationMode == d_integrationMode) &&
+      (header.integrationLength == d_integrationLength) &&
+      (fileSize == sizeof(header) + aggBytes + windowBytes);
+
+  // work() indexes the window with these, so they have to be in range too.
+  if (valid && windowBuffer)
+    valid = (header.windowIndex >= 0) &&
+            (header.windowIndex < d_integrationLength) &&
+            (header.windowCount >= 0) &&
+            (header.windowCount <= d_integrationLength);
+
+  if (valid) {
+    memcpy(aggBuffer, &pMap[sizeof(header)], aggBytes);
+
+    if (windowBytes > 0)
+      memcpy(windowBuffer, &pMap[sizeof(header) + aggBytes], windowBytes);
+
+    windowIndex = header.windowIndex;
+    windowCount = header.windowCount;
+    vectorsIntegrated = header.vectorsIntegrated;
+
+    // Carry the integration time forward
+    startTime = std::chrono::steady_clock::now() -
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(header.elapsedSeconds));
+
+    std::cout << "[LongTermIntegrator] Resuming from checkpoint "
+              << d_checkpointFile << " (" << vectorsIntegrated
+              << " vectors integrated)" << std::endl;
+  } else {
+    std::cout << "[LongTermIntegrator] Checkpoint file " << d_checkpointFile
+              << " doesn't match the current settings.  Starting fresh."
+              << std::endl;
+  }
+
+  munmap((void *)pMap, fileSize);
+
+  return valid;
+}
+
+void LongTermIntegrator_impl::handleSnapshotMsg(pmt::pmt_t msg) {
+  gr::thread::scoped_lock guard(d_mutex);
+
+  if (startCheckpoint())
+    lastSnapshot = std::chrono::steady_clock::now();
 }
 
 void LongTermIntegrator_impl::reset(bool bReset) {
   if (bReset) {
     gr::thread::scoped_lock guard(d_mutex);
 
-    // Zero out all aggregation buckets
-    for (int i = 0; i < d_fftsize; i++)
-      aggBuffer[i] = 0.0;
+    clearIntegration();
 
     // Reset integration time
     startTime = std::chrono::steady_clock::now();
+    reportPending = true;
   }
 }
 
 bool LongTermIntegrator_impl::stop() {
-  if (readThread) {
-    stopThread = true;
-
-    while (threadRunning) {
-      usleep(10000); // sleep 10 millisec
+  // Let any checkpoint in progress finish before the buffers go away
+  waitForCheckpoint();
+
+  if (aggBuffer && (d_checkpointFile.length() > 0)) {
+    // Save where we are so a restart picks up from here.  Nothing else is
+    // running now so this one's written directly.
+    {
+      gr::thread::scoped_lock guard(d_mutex);
+      copyCheckpoint();
     }
 
-    delete readThread;
-    readThread = NULL;
+    writeCheckpoint();
   }
 
   if (aggBuffer) {
@@ -131,6 +394,11 @@ bool LongTermIntegrator_impl::stop() {
     aggBuffer = NULL;
   }
 
+  if (windowBuffer) {
+    volk_free(windowBuffer);
+    windowBuffer = NULL;
+  }
+
   return true;
 }
 
@@ -145,31 +413,84 @@ int LongTermIntegrator_impl::work(int noutput_items,
   const float *in = (const float *)input_items[0];
   float *out = (float *)output_items[0];
   int noi = noutput_items * d_fftsize;
-  int baseIndex;
-  float max = in[0];
+  float max = 0.0;
   uint32_t maxIndex;
 
   gr::thread::scoped_lock guard(d_mutex);
 
   // Vectors have to be done individually to map into aggBuffer;
   for (int curVector = 0; curVector < noutput_items; curVector++) {
-    // aggBuffer[i] = aggBuffer[i] + in[curVector*d_fftsize + i];
-    volk_32f_x2_add_32f(aggBuffer, aggBuffer, &in[curVector * d_fftsize],
-                        d_fftsize);
+    const float *curIn = &in[curVector * d_fftsize];
+    float *curOut = &out[curVector * d_fftsize];
+
+    switch (d_integrationMode) {
+    case LTI_MODE_SLIDING: {
+      float *oldest = &windowBuffer[windowIndex * d_fftsize];
+
+      if (windowCount < d_integrationLength) {
+        // Still filling the window
+        volk_32f_64f_add_64f(aggBuffer, curIn, aggBuffer, d_fftsize);
+        windowCount++;
+      } else {
+        // Add the new vector and drop the oldest.  Each update still rounds,
+        // but in double the accumulated error stays far below float
+        // resolution over any practical run.
+        for (int i = 0; i < d_fftsize; i++)
+          aggBuffer[i] += (double)curIn[i] - (double)oldest[i];
+      }
+
+      memcpy(oldest, curIn, d_fftsize * sizeof(float));
+
+      windowIndex++;
+      if (windowIndex >= d_integrationLength)
+        windowIndex = 0;
+    } break;
+
+    case LTI_MODE_EXPONENTIAL:
+      for (int i = 0; i < d_fftsize; i++)
+        aggBuffer[i] = decayFactor * aggBuffer[i] + (double)curIn[i];
+      break;
+
+    default:
+      // aggBuffer[i] = aggBuffer[i] + in[curVector*d_fftsize + i];
+      volk_32f_64f_add_64f(aggBuffer, curIn, aggBuffer, d_fftsize);
+      break;
+    }
 
     // out[curVector*d_fftsize] = aggBuffer[i]
-    memcpy(&out[baseIndex], aggBuffer, d_fftsize * sizeof(float));
+    volk_64f_convert_32f(curOut, aggBuffer, d_fftsize);
+
+    vectorsIntegrated++;
 
     if (d_normalize) {
       // find max
-      volk_32f_index_max_32u(&maxIndex, aggBuffer, d_fftsize);
+      volk_32f_index_max_32u(&maxIndex, curOut, d_fftsize);
 
-      if (aggBuffer[maxIndex] > max)
-        max = aggBuffer[maxIndex];
+      if ((curVector == 0) || (curOut[maxIndex] > max))
+        max = curOut[maxIndex];
     }
   }
 
-  if (d_normalize) {
+  // One clock read per work() call covers both the runtime report and
+  // periodic snapshots.
+  std::chrono::time_point<std::chrono::steady_clock> curTimestamp =
+      std::chrono::steady_clock::now();
+
+  std::chrono::duration<double> sinceReport = curTimestamp - lastReport;
+
+  if (reportPending || (sinceReport.count() >= LTI_REPORT_INTERVAL_SEC))
+    sendRuntime(curTimestamp);
+
+  if (d_snapshotPeriodSec > 0.0) {
+    std::chrono::duration<double> elapsed_seconds = curTimestamp - lastSnapshot;
+
+    // If the last snapshot is still being written, try again next call
+    if ((elapsed_seconds.count() >= (double)d_snapshotPeriodSec) &&
+        startCheckpoint())
+      lastSnapshot = curTimestamp;
+  }
+
+  if (d_normalize && (max != 0.0)) {
     // now normalize
     // out[i] = out[i] / max * 100.0;
 
@@ -26,10 +26,17 @@
 
 using namespace std;
 using namespace MesaSignals;
-#include <boost/thread/thread.hpp>
+#include <atomic>
 #include <chrono>
 #include <ctime>
 
+#define LTI_MODE_CUMULATIVE 1
+#define LTI_MODE_SLIDING 2
+#define LTI_MODE_EXPONENTIAL 3
+
+// How often the runtime message goes out
+#define LTI_REPORT_INTERVAL_SEC 5.0
+
 namespace gr {
 namespace mesa {
 
@@ -37,19 +44,56 @@ class LongTermIntegrator_impl : public LongTermIntegrator {
 private:
   int d_fftsize;
   bool d_normalize;
-  float *aggBuffer;
+  int d_integrationMode;
+  int d_integrationLength;
+
+  // Accumulating in float stops registering small bins after long runs, so
+  // the running integration is kept in double.
+  double *aggBuffer;
   boost::mutex d_mutex;
 
-  std::chrono::time_point<std::chrono::steady_clock> startTime;
+  // Sliding mode: the last d_integrationLength input vectors
+  float *windowBuffer;
+  long windowIndex;
+  long windowCount;
+
+  // Exponential mode: agg = decayFactor * agg + in
+  double decayFactor;
+
+  uint64_t vectorsIntegrated;
 
-  boost::thread *readThread = NULL;
-  bool threadRunning;
-  bool stopThread;
+  // Checkpointing
+  std::string d_checkpointFile;
+  float d_snapshotPeriodSec;
+  std::chrono::time_point<std::chrono::steady_clock> lastSnapshot;
+
+  void clearIntegration();
+
+  // Checkpoints are copied into checkpointData under d_mutex and written to
+  // disk by writerThread, so work() never waits on file I/O.
+  std::vector<char> checkpointData;
+  boost::thread *writerThread;
+  std::atomic<bool> writerBusy;
+
+  void copyCheckpoint();
+  bool writeCheckpoint();
+  bool startCheckpoint();
+  void waitForCheckpoint();
+  bool loadCheckpoint();
+  void handleSnapshotMsg(pmt::pmt_t msg);
+
+  std::chrono::time_point<std::chrono::steady_clock> startTime;
+  std::chrono::time_point<std::chrono::steady_clock> lastReport;
+  bool reportPending;
 
-  void runThread();
+  void sendRuntime(const std::chrono::time_point<std::chrono::steady_clock>
+                       &curTimestamp);
 
 public:
-  LongTermIntegrator_impl(int fftsize, bool normalize);
+  LongTermIntegrator_impl(int fftsize, bool normalize, int integrationMode,
+                          int integrationLength,
+                          const std::string &checkpointFile,
+                          float snapshotPeriodSec);
   ~LongTermIntegrator_impl();
 
   virtual void reset(bool bReset);
@@ -23,7 +23,9 @@
 #endif
 
 #include "MaxPower_impl.h"
+#include <cstring>
 #include <gnuradio/io_signature.h>
+#include <volk/volk.h>
 
 namespace gr {
 namespace mesa {
@@ -31,10 +33,15 @@ namespace mesa {
 MaxPower::sptr MaxPower::make(double sampleRate, int fft_size,
                               float squelchThreshold, float framesToAvg,
                               bool produceOut, float stateThreshold,
-                              float holdUpSec) {
-  return gnuradio::get_initial_sptr(
-      new MaxPower_impl(sampleRate, fft_size, squelchThreshold, framesToAvg,
-                        produceOut, stateThreshold, holdUpSec));
+                              float holdUpSec, float avgWindowSec,
+                              int powerMode,
+                              const std::string &sharedSpectrum,
+                              int detectionOutput, int inputType,
+                              int windowType) {
+  return gnuradio::get_initial_sptr(new MaxPower_impl(
+      sampleRate, fft_size, squelchThreshold, framesToAvg, produceOut,
+      stateThreshold, holdUpSec, avgWindowSec, powerMode, sharedSpectrum,
+      detectionOutput, inputType, windowType));
 }
 
 /*
@@ -43,10 +50,15 @@ MaxPower::sptr MaxPower::make(double sampleRate, int fft_size,
 MaxPower_impl::MaxPower_impl(double sampleRate, int fft_size,
                              float squelchThreshold, float framesToAvg,
                              bool produceOut, float stateThreshold,
-                             float holdUpSec)
+                             float holdUpSec, float avgWindowSec,
+                             int powerMode,
+                             const std::string &sharedSpectrum,
+                             int detectionOutput, int inputType,
+                             int windowType)
     : gr::sync_block("MaxPower",
-                     gr::io_signature::make(0, 1, sizeof(gr_complex)),
-                     gr::io_signature::make(0, 0, 0)) {
+                     gr::io_signature::make(0, 1, sampleFormatSize(inputType)),
+                     gr::io_signature::make(0, 1, sampleFormatSize(inputType))),
+      tagKeys(DetectionTagKeys::get()) {
   d_startInitialized = false;
   d_holdUpSec = holdUpSec;
   curState = false;
@@ -58,22 +70,64 @@ MaxPower_impl::MaxPower_impl(double sampleRate, int fft_size,
   d_sampleRate = sampleRate;
   d_framesToAvg = framesToAvg;
   d_fftSize = fft_size;
+  d_requestedFFTSize = fft_size;
+  d_blockSize = fft_size * d_framesToAvg;
   d_produceOut = produceOut;
   d_squelchThreshold =
       squelchThreshold; // This is also available in the energy analyzer, but
                         // this saves us a fn call in work
 
-  // Create energy analyzer
-  pEnergyAnalyzer = new EnergyAnalyzer(d_fftSize, squelchThreshold, 0.0);
+  d_powerMode = powerMode;
+  powerBuffer = NULL;
+
+  if ((detectionOutput < DETECTION_OUTPUT_MESSAGES) ||
+      (detectionOutput > DETECTION_OUTPUT_BOTH)) {
+    throw std::out_of_range("[MaxPower] Unknown detection output");
+  }
+
+  d_detectionOutput = detectionOutput;
+
+  if ((inputType < SAMPLE_FORMAT_COMPLEX) || (inputType > SAMPLE_FORMAT_SC8)) {
+    throw std::out_of_range("[MaxPower] Unknown input type");
+  }
+
+  d_inputType = inputType;
+  d_itemSize = sampleFormatSize(inputType);
+
+  if ((windowType < WINDOWTYPE_NONE) ||
+      (windowType > WINDOWTYPE_BLACKMAN_HARRIS)) {
+    throw std::out_of_range("[MaxPower] Unknown window type");
+  }
+
+  d_windowType = windowType;
+  complexBuffer = NULL;
+  complexBufferSize = 0;
+  powerBufferSize = 0;
+
+  // Create energy analyzer.  The time-domain modes don't need one.
+  if (d_powerMode == MAXPOWER_MODE_SPECTRUM) {
+    pEnergyAnalyzer = new EnergyAnalyzer(d_fftSize, squelchThreshold, 0.0);
+    pEnergyAnalyzer->setSharedSpectrum(sharedSpectrum);
+
+    if (d_windowType != WINDOWTYPE_BLACKMAN_HARRIS)
+      pEnergyAnalyzer->setWindowType(d_windowType);
+  } else {
+    pEnergyAnalyzer = NULL;
+  }
 
   // buffer capacity is for n seconds.  framestoavg * d_fftSize is the samples /
   // block.  sample rate / that gets you blocks / sec.  Times seconds to avg
-  // gets you how many calls you need to average. float secondsToAvg = 0.2;
-  // float fBufferCapacity = secondsToAvg * d_sampleRate / (d_framesToAvg *
-  // d_fftSize);
-
-  // iBufferCapacity = (int)fBufferCapacity;
-  iBufferCapacity = 5;
+  // gets you how many calls you need to average.
+  // A window of 0 seconds keeps the original 5-reading window.
+  d_avgWindowSec = avgWindowSec;
+
+  if (d_avgWindowSec > 0.0) {
+    float fBufferCapacity =
+        d_avgWindowSec * d_sampleRate / (d_framesToAvg * d_fftSize);
+    iBufferCapacity = (int)fBufferCapacity;
+  } else {
+    iBufferCapacity = 5;
+  }
 
   if (iBufferCapacity == 0) {
     iBufferCapacity = 1;
@@ -82,7 +136,10 @@ MaxPower_impl::MaxPower_impl(double sampleRate, int fft_size,
   // std::cout << "Starting maxpower with a " << iBufferCapacity << " averaging
   // buffer." << std::endl;
 
-  maxBuffer = new boost::circular_buffer<float>(iBufferCapacity);
+  // Drops the highest and lowest readings before averaging.  At the default
+  // 5 readings that's 1 off each end.
+  maxBuffer = new SlidingTrimmedMean(
+      iBufferCapacity, (long)(iBufferCapacity * MAXPOWER_TRIM_FRACTION));
 
   message_port_register_in(pmt::mp("msgin"));
   set_msg_handler(pmt::mp("msgin"),
@@ -111,6 +168,18 @@ bool MaxPower_impl::stop() {
     maxBuffer = NULL;
   }
 
+  if (powerBuffer) {
+    volk_free(powerBuffer);
+    powerBuffer = NULL;
+    powerBufferSize = 0;
+  }
+
+  if (complexBuffer) {
+    volk_free(complexBuffer);
+    complexBuffer = NULL;
+    complexBufferSize = 0;
+  }
+
   return true;
 }
 
@@ -122,78 +191,99 @@ void MaxPower_impl::handleMsgIn(pmt::pmt_t msg) {
 
   cc_samples = pmt::c32vector_elements(data, noutput_items);
 
-  int retVal = processData(noutput_items, cc_samples);
+  gr::thread::scoped_lock guard(d_mutex);
+  int retVal = processData(noutput_items, cc_samples, SAMPLE_FORMAT_COMPLEX,
+                           false, false);
 }
 
-float MaxPower_impl::calcAverage() {
-  // Average will throw away the highest and lowest, and take the average of the
-  // remaining values.
-  float min = (*maxBuffer)[0];
-  float max = min;
-  float curVal;
-  float maxTotal = 0.0;
+const gr_complex *MaxPower_impl::toComplex(int noutput_items, const void *in,
+                                           int sampleFormat) {
+  if (sampleFormat == SAMPLE_FORMAT_COMPLEX)
+    return (const gr_complex *)in;
 
-  for (int i = 0; i < maxBuffer->size(); i++) {
-    curVal = (*maxBuffer)[i];
-    maxTotal += curVal;
+  if (noutput_items > complexBufferSize) {
+    if (complexBuffer)
+      volk_free(complexBuffer);
 
-    if (curVal < min) {
-      min = curVal;
-    } else {
-      if (curVal > max) {
-        max = curVal;
-      }
-    }
+    size_t memAlignment = volk_get_alignment();
+    complexBuffer = (SComplex *)volk_malloc(noutput_items * sizeof(SComplex),
+                                            memAlignment);
+    complexBufferSize = noutput_items;
   }
 
-  float maxAvg;
-
-  if (maxBuffer->size() == iBufferCapacity) {
-    // Take out min and max values
-    maxTotal = maxTotal - min - max;
-    maxAvg = maxTotal / (iBufferCapacity - 2);
-  } else {
-    // We haven't seen enough frames yet to fill the buffer.  We're still
-    // queueing
-    maxAvg = maxTotal / maxBuffer->size();
-  }
+  convertToComplex(in, sampleFormat, noutput_items, complexBuffer);
 
-  return maxAvg;
+  return complexBuffer;
 }
 
-int MaxPower_impl::processData(int noutput_items, const gr_complex *in) {
-  gr::thread::scoped_lock guard(d_mutex);
+int MaxPower_impl::processData(int noutput_items, const void *in,
+                               int sampleFormat, bool streamInput,
+                               bool tagOutput) {
+  // Called with d_mutex held.  Only work() swaps in a new FFT size, so
+  // message data never changes the stream's block size.
+
+
+  // Tags-only mode skips the maxpower/state messages for stream data.  The
+  // message input has no stream to tag so it always sends messages.
+  bool sendMessages =
+      !tagOutput || (d_detectionOutput != DETECTION_OUTPUT_TAGS);
+
+  float maxPower;
+
+  // Only made if something needs float samples
+  const gr_complex *complexIn = NULL;
+
+  if (d_powerMode == MAXPOWER_MODE_SPECTRUM) {
+    FloatVector maxSpectrum;
 
-  FloatVector maxSpectrum;
+    // last boolean param indicates to use the squelch for values below the
+    // configured squelch threshold.
+    // Message data has no stream position so it can't use a shared spectrum
+    // Integer samples go straight into the FFT with no float copy.
+    int64_t startSample = -1;
 
-  // last boolean param indicates to use the squelch for values below the
-  // configured squelch threshold.
-  long samplesProcessed =
-      pEnergyAnalyzer->maxHold(in, noutput_items, maxSpectrum, true);
+    if (streamInput)
+      startSample = (int64_t)nitems_read(0);
 
-  float maxPower = pEnergyAnalyzer->maxPower(maxSpectrum);
+    long samplesProcessed = pEnergyAnalyzer->maxHold(
+        in, sampleFormat, noutput_items, startSample, maxSpectrum, true);
 
-  maxBuffer->push_back(maxPower);
-  float maxTotal = 0.0;
+    maxPower = pEnergyAnalyzer->maxPower(maxSpectrum);
+  } else {
+    complexIn = toComplex(noutput_items, in, sampleFormat);
+    maxPower = timeDomainPower(noutput_items, complexIn);
+  }
+
+  maxBuffer->add(maxPower);
 
   // Wait till we have enough to do an average before we start sending data.
-  if (maxBuffer->size() >= iBufferCapacity) {
-    // Note: circular buffer size() returns the number of items in the buffer.
-    // If the number of items < capacity, the number of items in the buffer are
-    // returned, so the following loop should always be good.
-    float maxAvg = calcAverage();
+  if (maxBuffer->full()) {
+    float maxAvg = maxBuffer->getMean();
+    uint64_t tagOffset = 0;
+
+    if (tagOutput) {
+      tagOffset = nitems_written(0);
+      add_item_tag(0, tagOffset, tagKeys.maxPower, pmt::from_float(maxAvg));
+    }
 
     // Send maxpower message
-    pmt::pmt_t meta = pmt::make_dict();
-    meta =
-        pmt::dict_add(meta, pmt::mp("decisionvalue"), pmt::from_float(maxAvg));
-    meta = pmt::dict_add(meta, pmt::mp("maxpower"), pmt::from_float(maxAvg));
-    meta = pmt::dict_add(meta, pmt::mp("squelch"),
-                         pmt::from_float(d_squelchThreshold));
+    pmt::pmt_t meta = pmt::PMT_NIL;
+
+    if (sendMessages || d_produceOut) {
+      meta = pmt::make_dict();
+      meta = pmt::dict_add(meta, pmt::mp("decisionvalue"),
+                           pmt::from_float(maxAvg));
+      meta =
+          pmt::dict_add(meta, pmt::mp("maxpower"), pmt::from_float(maxAvg));
+      meta = pmt::dict_add(meta, pmt::mp("squelch"),
+                           pmt::from_float(d_squelchThreshold));
+    }
 
-    pmt::pmt_t pdu = pmt::cons(meta, pmt::PMT_NIL);
+    if (sendMessages) {
+      pmt::pmt_t pdu = pmt::cons(meta, pmt::PMT_NIL);
 
-    message_port_pub(pmt::mp("maxpower"), pdu);
+      message_port_pub(pmt::mp("maxpower"), pdu);
+    }
 
     // Test our state conditions
     if (maxAvg >= d_stateThreshold) {
@@ -203,7 +293,12 @@ int MaxPower_impl::processData(int noutput_items, const gr_complex *in) {
       // std::cout << "[Debug] Power above threshold" << std::endl;
       if (!curState) {
         // std::cout << "[Debug] Sending state true" << std::endl;
-        sendState(true);
+        if (sendMessages)
+          sendState(true);
+
+        if (tagOutput)
+          add_item_tag(0, tagOffset, tagKeys.detect, pmt::PMT_T);
+
         curState = true;
       }
     } else {
@@ -218,7 +313,12 @@ int MaxPower_impl::processData(int noutput_items, const gr_complex *in) {
         if (std::chrono::duration<double>(curTimestamp - holdTime).count() >
             (double)d_holdUpSec) {
           // std::cout << "[Debug] Sending state false" << std::endl;
-          sendState(false);
+          if (sendMessages)
+            sendState(false);
+
+          if (tagOutput)
+            add_item_tag(0, tagOffset, tagKeys.detect, pmt::PMT_F);
+
           curState = false;
         }
       }
@@ -226,7 +326,10 @@ int MaxPower_impl::processData(int noutput_items, const gr_complex *in) {
 
     // Send data message
     if (d_produceOut) {
-      pmt::pmt_t data_out(pmt::init_c32vector(noutput_items, in));
+      if (!complexIn)
+        complexIn = toComplex(noutput_items, in, sampleFormat);
+
+      pmt::pmt_t data_out(pmt::init_c32vector(noutput_items, complexIn));
       pmt::pmt_t datapdu = pmt::cons(meta, data_out);
 
       message_port_pub(pmt::mp("out"), datapdu);
@@ -237,6 +340,57 @@ int MaxPower_impl::processData(int noutput_items, const gr_complex *in) {
   return noutput_items;
 }
 
+float MaxPower_impl::timeDomainPower(int noutput_items, const gr_complex *in) {
+  // For pre-filtered single-channel inputs we don't need the spectrum, just
+  // the power.  Average is the mean of |x|^2 over the input (by Parseval,
+  // the mean of the FFT bin powers, not their sum), and peak is the max
+  // instantaneous envelope power.
+  //
+  // The spectrum mode's PSD is |X|^2/N^2, so a tone of amplitude A reads as
+  // A^2 times the window's coherent gain squared.  That window loss is
+  // applied here so a steady tone reads the same in every mode and the
+  // thresholds carry over.  Broadband noise still reads differently, since
+  // the spectrum mode only sees one bin's share of it.
+  if (noutput_items <= 0)
+    return NOISE_FLOOR;
+
+  if (noutput_items > powerBufferSize) {
+    if (powerBuffer)
+      volk_free(powerBuffer);
+
+    size_t memAlignment = volk_get_alignment();
+    powerBuffer =
+        (float *)volk_malloc(noutput_items * sizeof(float), memAlignment);
+    powerBufferSize = noutput_items;
+  }
+
+  volk_32fc_magnitude_squared_32f(powerBuffer, in, noutput_items);
+
+  float power;
+
+  if (d_powerMode == MAXPOWER_MODE_PEAK) {
+    uint32_t maxIndex;
+    volk_32f_index_max_32u(&maxIndex, powerBuffer, noutput_items);
+    power = powerBuffer[maxIndex];
+  } else {
+    float sum;
+    volk_32f_accumulator_s32f(&sum, powerBuffer, noutput_items);
+    power = sum / (float)noutput_items;
+  }
+
+  if (power <= 0.0)
+    return NOISE_FLOOR;
+
+  float windowGain = windowCoherentGain(d_windowType);
+  float powerDB = 10.0 * log10(power * windowGain * windowGain);
+
+  if ((d_squelchThreshold != SQUELCH_DISABLE) &&
+      (powerDB <= d_squelchThreshold))
+    powerDB = NOISE_FLOOR;
+
+  return powerDB;
+}
+
 void MaxPower_impl::sendState(bool state) {
   int newState;
   if (state) {
@@ -253,16 +407,91 @@ void MaxPower_impl::sendState(bool state) {
 int MaxPower_impl::work(int noutput_items,
                         gr_vector_const_void_star &input_items,
                         gr_vector_void_star &output_items) {
-  const gr_complex *in = (const gr_complex *)input_items[0];
+  const void *in = input_items[0];
+
+  // The output is an optional passthrough that carries the detection tags.
+  bool haveOutput = (output_items.size() > 0);
+
+  if (haveOutput)
+    memcpy(output_items[0], in, noutput_items * d_itemSize);
+
+  gr::thread::scoped_lock guard(d_mutex);
 
-  return processData(noutput_items, in);
+  // Pick up a new FFT size or window if one's ready
+  applyReconfig();
+
+  return processData(noutput_items, in, d_inputType, true,
+                     haveOutput &&
+                         (d_detectionOutput != DETECTION_OUTPUT_MESSAGES));
 }
 
 float MaxPower_impl::getSquelchThreshold() const { return d_squelchThreshold; }
 
 void MaxPower_impl::setSquelchThreshold(float newValue) {
+  gr::thread::scoped_lock guard(d_mutex);
+
   d_squelchThreshold = newValue;
-  pEnergyAnalyzer->setThreshold(newValue);
+
+  if (pEnergyAnalyzer)
+    pEnergyAnalyzer->setThreshold(newValue);
+}
+
+int MaxPower_impl::getFFTSize() const { return d_fftSize; }
+
+void MaxPower_impl::setFFTSize(int newValue) {
+  gr::thread::scoped_lock guard(d_mutex);
+
+  if (newValue == d_requestedFFTSize)
+    return;
+
+  // The flowgraph's buffers were sized for the startup block size, so an FFT
+  // frame can't be bigger than that.  The DC swap needs an even size.
+  if ((newValue < 2) || ((newValue % 2) != 0) || (newValue > d_blockSize)) {
+    throw std::out_of_range("[MaxPower] FFT size must be even and no "
+                            "larger than the startup block size");
+  }
+
+  d_requestedFFTSize = newValue;
+
+  // The new FFT is planned here, not in work().  It's swapped in at the
+  // start of the next block.  Holding d_mutex keeps work() from swapping
+  // out the analyzer it's built from.
+  if (pEnergyAnalyzer)
+    analyzerReconfig.queue(pEnergyAnalyzer, d_requestedFFTSize,
+                           d_windowType);
+}
+
+int MaxPower_impl::getWindowType() const { return d_windowType; }
+
+void MaxPower_impl::setWindowType(int newValue) {
+  gr::thread::scoped_lock guard(d_mutex);
+
+  if (newValue == d_windowType)
+    return;
+
+  if ((newValue < WINDOWTYPE_NONE) || (newValue > WINDOWTYPE_BLACKMAN_HARRIS))
+    throw std::out_of_range("[MaxPower] Unknown window type");
+
+  d_windowType = newValue;
+  if (pEnergyAnalyzer)
+    analyzerReconfig.queue(pEnergyAnalyzer, d_requestedFFTSize,
+                           d_windowType);
+}
+
+void MaxPower_impl::applyReconfig() {
+  // Called with d_mutex held, so this is always on a block boundary.
+  if (!pEnergyAnalyzer || !analyzerReconfig.swap(pEnergyAnalyzer))
+    return;
+
+  d_fftSize = pEnergyAnalyzer->getFFTSize();
+
+  // Average as many frames as fit in the startup block size
+  d_framesToAvg = d_blockSize / d_fftSize;
+
+  if (d_framesToAvg < 1)
+    d_framesToAvg = 1;
+
+  gr::block::set_output_multiple(d_fftSize * d_framesToAvg);
 }
 
 float MaxPower_impl::getStateThreshold() const { return d_stateThreshold; }
@@ -21,14 +21,23 @@
 #ifndef INCLUDED_MESA_MAXPOWER_IMPL_H
 #define INCLUDED_MESA_MAXPOWER_IMPL_H
 
+#include "detection_tags_mesa.h"
 #include "signals_mesa.h"
-#include <boost/circular_buffer.hpp>
+#include "stats_mesa.h"
 #include <chrono>
 #include <ctime>
 #include <mesa/MaxPower.h>
 
 using namespace MesaSignals;
 
+// Fraction of the averaging window dropped from each end before averaging
+#define MAXPOWER_TRIM_FRACTION 0.2
+
+// How power is measured.  The time-domain modes skip the FFT entirely.
+#define MAXPOWER_MODE_SPECTRUM 1
+#define MAXPOWER_MODE_AVERAGE 2
+#define MAXPOWER_MODE_PEAK 3
+
 namespace gr {
 namespace mesa {
 
@@ -44,10 +53,38 @@ private:
   int d_fftSize;
 
   bool d_produceOut;
-
+  int d_powerMode;
+  int d_detectionOutput;
+  const DetectionTagKeys &tagKeys;
+
+  // Runtime FFT size / window changes.  d_blockSize is the analysis block
+  // size the flowgraph's buffers were sized for at startup.  Later FFT sizes
+  // average as many frames as fit in it.
+  AnalyzerReconfig analyzerReconfig;
+  int d_blockSize;
+  int d_requestedFFTSize;
+  int d_windowType;
+  void applyReconfig();
+
+  // SAMPLE_FORMAT_* of the stream input.  Message input is always complex.
+  int d_inputType;
+  int d_itemSize;
+
+  // Complex copy of integer input for the paths that need float samples
+  SComplex *complexBuffer;
+  int complexBufferSize;
+  const gr_complex *toComplex(int noutput_items, const void *in,
+                              int sampleFormat);
+
+  // |x|^2 scratch for the time-domain modes
+  float *powerBuffer;
+  int powerBufferSize;
+
+  float d_avgWindowSec;
   int iBufferCapacity;
 
-  boost::circular_buffer<float> *maxBuffer;
+  // Trimmed mean of the last iBufferCapacity max power readings
+  SlidingTrimmedMean *maxBuffer;
 
   bool d_startInitialized;
   float d_holdUpSec;
@@ -57,15 +94,17 @@ private:
 
   virtual void handleMsgIn(pmt::pmt_t msg);
 
-  virtual int processData(int noutput_items, const gr_complex *in);
+  virtual int processData(int noutput_items, const void *in,
+                          int sampleFormat, bool streamInput, bool tagOutput);
+  virtual float timeDomainPower(int noutput_items, const gr_complex *in);
   virtual void sendState(bool state);
 
-  virtual float calcAverage();
-
 public:
   MaxPower_impl(double sampleRate, int fft_size, float squelchThreshold,
                 float framesToAvg, bool produceOut, float stateThreshold,
-                float holdUpSec);
+                float holdUpSec, float avgWindowSec, int powerMode,
+                const std::string &sharedSpectrum, int detectionOutput,
+                int inputType, int windowType);
   ~MaxPower_impl();
 
   void setup_rpc();
@@ -76,6 +115,12 @@ public:
   virtual float getHoldTime() const;
   virtual void setHoldTime(float newValue);
 
+  virtual int getFFTSize() const;
+  virtual void setFFTSize(int newValue);
+
+  virtual int getWindowType() const;
+  virtual void setWindowType(int newValue);
+
   virtual bool stop();
 
   // Where all the action really happens
@@ -22,7 +22,8 @@
 #include "config.h"
 #endif
 
-#include <cstring> // memcpy
+#include <algorithm> // std::min
+#include <cstring>   // memcpy
 
 #include "SignalDetector_impl.h"
 #include <gnuradio/io_signature.h>
@@ -33,11 +34,16 @@ namespace mesa {
 SignalDetector::sptr SignalDetector::make(
     int fftsize, float squelchThreshold, double minWidthHz, double maxWidthHz,
     double radioCenterFreq, double sampleRate, float holdUpSec, int framesToAvg,
-    bool genSignalPDUs, bool enableDebug, int detectionMethod) {
+    bool genSignalPDUs, bool enableDebug, int detectionMethod,
+    int analyzeFrames, int frameStride, bool adaptiveAnalysis,
+    const std::string &sharedSpectrum, int outputMode, int pduMode,
+    int detectionOutput, int inputType, int windowType) {
   return gnuradio::get_initial_sptr(new SignalDetector_impl(
       fftsize, squelchThreshold, minWidthHz, maxWidthHz, radioCenterFreq,
       sampleRate, holdUpSec, framesToAvg, genSignalPDUs, enableDebug,
-      detectionMethod));
+      detectionMethod, analyzeFrames, frameStride, adaptiveAnalysis,
+      sharedSpectrum, outputMode, pduMode, detectionOutput, inputType,
+      windowType));
 }
 
 /*
@@ -48,10 +54,17 @@ SignalDetector_impl::SignalDetector_impl(int fftsize, float squelchThreshold,
                                          double radioCenterFreq,
                                          double sampleRate, float holdUpSec,
                                          int framesToAvg, bool genSignalPDUs,
-                                         bool enableDebug, int detectionMethod)
-    : gr::sync_block("SignalDetector",
-                     gr::io_signature::make(1, 1, sizeof(gr_complex)),
-                     gr::io_signature::make(1, 1, sizeof(gr_complex))) {
+                                         bool enableDebug, int detectionMethod,
+                                         int analyzeFrames, int frameStride,
+                                         bool adaptiveAnalysis,
+                                         const std::string &sharedSpectrum,
+                                         int outputMode, int pduMode,
+                                         int detectionOutput, int inputType,
+                                         int windowType)
+    : gr::block("SignalDetector",
+                gr::io_signature::make(1, 1, sampleFormatSize(inputType)),
+                gr::io_signature::make(1, 1, sampleFormatSize(inputType))),
+      tagKeys(DetectionTagKeys::get()) {
   pMsgOutBuff = NULL;
 
   // Store variables
@@ -69,13 +82,70 @@ SignalDetector_impl::SignalDetector_impl(int fftsize, float squelchThreshold,
 
   d_genSignalPDUs = genSignalPDUs;
 
+  if ((outputMode < SIGDETECTOR_OUTPUT_CONTINUOUS) ||
+      (outputMode > SIGDETECTOR_OUTPUT_GATED)) {
+    throw std::out_of_range("[SignalDetector] Unknown output mode");
+  }
+
+  d_outputMode = outputMode;
+
+  if ((pduMode < SIGDETECTOR_PDU_FULLBLOCK) ||
+      (pduMode > SIGDETECTOR_PDU_NARROWBAND)) {
+    throw std::out_of_range("[SignalDetector] Unknown PDU mode");
+  }
+
+  d_pduMode = pduMode;
+
+  if (d_genSignalPDUs && (d_pduMode == SIGDETECTOR_PDU_NARROWBAND))
+    pExtractor = new SignalExtractor(d_sampleRate);
+  else
+    pExtractor = NULL;
+
+  if ((detectionOutput < DETECTION_OUTPUT_MESSAGES) ||
+      (detectionOutput > DETECTION_OUTPUT_BOTH)) {
+    throw std::out_of_range("[SignalDetector] Unknown detection output");
+  }
+
+  d_detectionOutput = detectionOutput;
+
+  if ((inputType < SAMPLE_FORMAT_COMPLEX) || (inputType > SAMPLE_FORMAT_SC8)) {
+    throw std::out_of_range("[SignalDetector] Unknown input type");
+  }
+
+  d_inputType = inputType;
+  complexBuffer = NULL;
+  complexBufferSize = 0;
+
+  // In gated mode, output offsets don't line up with input offsets, so tags
+  // are moved across in general_work.
+  set_tag_propagation_policy(TPP_DONT);
+
   // Calc Duty Cycle
   float minDutyCycle = calcMinDutyCycle();
 
+  if ((windowType < WINDOWTYPE_NONE) ||
+      (windowType > WINDOWTYPE_BLACKMAN_HARRIS)) {
+    throw std::out_of_range("[SignalDetector] Unknown window type");
+  }
+
+  d_windowType = windowType;
+  d_requestedFFTSize = fftsize;
+  d_blockSize = fftsize * d_framesToAvg;
+
   // Create energy analyzer
   pEnergyAnalyzer = new EnergyAnalyzer(fftsize, squelchThreshold, minDutyCycle);
   d_detectionMethod = detectionMethod;
 
+  if (d_windowType != WINDOWTYPE_BLACKMAN_HARRIS)
+    pEnergyAnalyzer->setWindowType(d_windowType);
+
+  // Only FFT analyzeFrames of every frameStride frames (1 of 1 is everything)
+  pEnergyAnalyzer->setFrameStride(analyzeFrames, frameStride,
+                                  adaptiveAnalysis);
+
+  // Share FFT's with other mesa blocks on the same stream
+  pEnergyAnalyzer->setSharedSpectrum(sharedSpectrum);
+
   // Make sure we have a multiple of fftsize coming in
   gr::block::set_output_multiple(fftsize * d_framesToAvg);
 
@@ -102,6 +172,8 @@ float SignalDetector_impl::getSquelch() const {
 }
 
 void SignalDetector_impl::setSquelch(float newValue) {
+  gr::thread::scoped_lock guard(d_mutex);
+
   pEnergyAnalyzer->setThreshold(newValue);
 
   if (d_enableDebug)
@@ -136,6 +208,8 @@ double SignalDetector_impl::getMinWidthHz() const { return d_minWidthHz; }
 
 void SignalDetector_impl::setMinWidthHz(double newValue) {
   // Calc Duty Cycle
+  gr::thread::scoped_lock guard(d_mutex);
+
   d_minWidthHz = newValue;
   float minDutyCycle = calcMinDutyCycle();
   pEnergyAnalyzer->setDutyCycle(minDutyCycle);
@@ -160,12 +234,23 @@ bool SignalDetector_impl::stop() {
     pEnergyAnalyzer = NULL;
   }
 
+  if (pExtractor) {
+    delete pExtractor;
+    pExtractor = NULL;
+  }
+
   if (pMsgOutBuff) {
     volk_free(pMsgOutBuff);
     msgBufferSize = 0;
     pMsgOutBuff = NULL;
   }
 
+  if (complexBuffer) {
+    volk_free(complexBuffer);
+    complexBuffer = NULL;
+    complexBufferSize = 0;
+  }
+
   return true;
 }
 
@@ -194,8 +279,30 @@ void SignalDetector_impl::handleMsgIn(pmt::pmt_t msg) {
         (SComplex *)volk_malloc(noutput_items * sizeof(SComplex), memAlignment);
   }
 
-  int result =
-      processData(noutput_items, cc_samples, pMsgOutBuff, &inputMetadata);
+  gr::thread::scoped_lock guard(d_mutex);
+  int result = processData(noutput_items, cc_samples, SAMPLE_FORMAT_COMPLEX,
+                           pMsgOutBuff, &inputMetadata);
+}
+
+const gr_complex *SignalDetector_impl::toComplex(int noutput_items,
+                                                 const void *in,
+                                                 int sampleFormat) {
+  if (sampleFormat == SAMPLE_FORMAT_COMPLEX)
+    return (const gr_complex *)in;
+
+  if (noutput_items > complexBufferSize) {
+    if (complexBuffer)
+      volk_free(complexBuffer);
+
+    size_t memAlignment = volk_get_alignment();
+    complexBuffer = (SComplex *)volk_malloc(noutput_items * sizeof(SComplex),
+                                            memAlignment);
+    complexBufferSize = noutput_items;
+  }
+
+  convertToComplex(in, sampleFormat, noutput_items, complexBuffer);
+
+  return complexBuffer;
 }
 
 void SignalDetector_impl::sendState(bool state) {
@@ -211,13 +318,24 @@ void SignalDetector_impl::sendState(bool state) {
   message_port_pub(pmt::mp("state"), pdu);
 }
 
-int SignalDetector_impl::processData(int noutput_items, const gr_complex *in,
-                                     gr_complex *out, pmt::pmt_t *pMetadata) {
-  gr::thread::scoped_lock guard(d_mutex);
+int SignalDetector_impl::processData(int noutput_items, const void *in,
+                                     int sampleFormat, void *out,
+                                     pmt::pmt_t *pMetadata) {
+  // Called with d_mutex held.  Only work() swaps in a new FFT size, so
+  // message data never changes the stream's block size.
+
   // First get the max hold curve for this block
   FloatVector maxSpectrum;
-  long samplesProcessed =
-      pEnergyAnalyzer->maxHold(in, noutput_items, maxSpectrum, true);
+  // Message data has no stream position so it can't use a shared spectrum.
+  // Integer samples go straight into the FFT with no float copy.
+  int64_t startSample = -1;
+
+  if (!pMetadata)
+    startSample = (int64_t)nitems_read(0);
+
+  long samplesProcessed = pEnergyAnalyzer->maxHold(
+      in, sampleFormat, noutput_items, startSample, maxSpectrum, true);
+  int itemSize = sampleFormatSize(sampleFormat);
 
   // Now look if we have signals
   int numSignals = 0;
@@ -242,15 +360,6 @@ int SignalDetector_impl::processData(int noutput_items, const gr_complex *in,
     }
   }
 
-  // If we have signals, deal with that (set PDU, etc.)
-  // Tell runtime system how many output items we produced.
-  if (numSignals > 0) {
-    memcpy((void *)out, (void *)in, noutput_items * sizeof(gr_complex));
-
-  } else {
-    memset(out, 0, noutput_items * sizeof(gr_complex));
-  }
-
   // start initialized tracks if we've picked up a signal and we're in a "high"
   // / have signal state
   bool justDetectedSignal = false; // first detection
@@ -300,21 +409,98 @@ int SignalDetector_impl::processData(int noutput_items, const gr_complex *in,
   // numSignals
   // Number of signals if signals were detected
 
-  // If just detected signal, send new PDU
-  if (justDetectedSignal) {
-    // Find the max power signal:
-    double maxCtrFreq = 0.0;
-    double maxWidth = 0.0;
-    float maxPower = -999.0;
+  // Find the max power signal:
+  double maxCtrFreq = 0.0;
+  double maxWidth = 0.0;
+  float maxPower = -999.0;
 
-    for (int i = 0; i < signalVector.size(); i++) {
-      if (signalVector[i].maxPower > maxPower) {
-        maxCtrFreq = signalVector[i].centerFreqHz;
-        maxWidth = signalVector[i].widthHz;
-        maxPower = signalVector[i].maxPower;
+  for (int i = 0; i < signalVector.size(); i++) {
+    if (signalVector[i].maxPower > maxPower) {
+      maxCtrFreq = signalVector[i].centerFreqHz;
+      maxWidth = signalVector[i].widthHz;
+      maxPower = signalVector[i].maxPower;
+    }
+  }
+
+  // Stream output.  In continuous mode, data is passed when signals are
+  // present, otherwise zeros.  In gated mode, nothing is produced unless we're
+  // in a burst.  A burst runs from the detection through the hold time up to
+  // and including the block where the signal is declared lost, so the eob
+  // always lands on a sample we actually produce.
+  int numOutputItems = noutput_items;
+  bool streamOutput = (pMetadata == NULL);
+
+  if (d_outputMode == SIGDETECTOR_OUTPUT_GATED) {
+    if (signalPresent || inHoldDown || lostSignal) {
+      memcpy(out, in, noutput_items * itemSize);
+
+      if (streamOutput) {
+        forwardTags(noutput_items);
+
+        uint64_t writeStart = nitems_written(0);
+
+        if (justDetectedSignal) {
+          add_item_tag(0, writeStart, tagKeys.sob, pmt::PMT_T);
+
+          // With detection tags on, the signal info comes with the detect
+          // tag below instead.
+          if (d_detectionOutput == DETECTION_OUTPUT_MESSAGES) {
+            add_item_tag(0, writeStart, tagKeys.signalCenterFreq,
+                         pmt::from_double(maxCtrFreq));
+            add_item_tag(0, writeStart, tagKeys.widthHz,
+                         pmt::from_double(maxWidth));
+            add_item_tag(0, writeStart, tagKeys.maxPower,
+                         pmt::from_float(maxPower));
+          }
+        }
+
+        if (lostSignal)
+          add_item_tag(0, writeStart + noutput_items - 1, tagKeys.eob,
+                       pmt::PMT_T);
       }
+    } else {
+      numOutputItems = 0;
     }
+  } else {
+    if (numSignals > 0) {
+      memcpy(out, in, noutput_items * itemSize);
+    } else {
+      memset(out, 0, noutput_items * itemSize);
+    }
+
+    if (streamOutput)
+      forwardTags(noutput_items);
+  }
 
+  // Detection tags go at the start of the first frame with energy over the
+  // squelch.  Loss goes at the start of the block where the hold time ran
+  // out.
+  bool sendTags = streamOutput && (numOutputItems > 0) &&
+                  (d_detectionOutput != DETECTION_OUTPUT_MESSAGES);
+
+  if (sendTags && justDetectedSignal) {
+    long activeOffset = 0;
+    long activeFrame = pEnergyAnalyzer->getFirstActiveFrame();
+
+    if (activeFrame > 0)
+      activeOffset = activeFrame * d_fftSize;
+
+    if (activeOffset >= noutput_items)
+      activeOffset = 0;
+
+    addDetectionTags(nitems_written(0) + activeOffset, signalVector.size(),
+                     maxCtrFreq, maxWidth, maxPower);
+  }
+
+  if (sendTags && lostSignal)
+    add_item_tag(0, nitems_written(0), tagKeys.detect, pmt::PMT_F);
+
+  // Message data always gets messages, there's no stream to tag.
+  bool sendMessages =
+      !streamOutput || (d_detectionOutput != DETECTION_OUTPUT_TAGS);
+
+  // If just detected signal, send new PDU
+  if (justDetectedSignal && sendMessages) {
     pmt::pmt_t meta = pmt::make_dict();
 
     meta = pmt::dict_add(meta, pmt::mp("state"), pmt::mp(1));
@@ -335,7 +521,7 @@ int SignalDetector_impl::processData(int noutput_items, const gr_complex *in,
     sendState(true);
   }
   // if Just lost signal, send PDU
-  if (lostSignal) {
+  if (lostSignal && sendMessages) {
     pmt::pmt_t meta = pmt::make_dict();
 
     meta = pmt::dict_add(meta, pmt::mp("state"), pmt::mp(0));
@@ -350,8 +536,17 @@ int SignalDetector_impl::processData(int noutput_items, const gr_complex *in,
   }
 
   // This takes some processing, so we only do this if it's requested.
-  if (d_genSignalPDUs) {
-    pmt::pmt_t data_out(pmt::init_c32vector(noutput_items, in));
+  // PDU's carry complex data, so integer input is converted here, and only
+  // when there's a signal to send.
+  const gr_complex *complexIn = NULL;
+
+  if (d_genSignalPDUs && (signalVector.size() > 0))
+    complexIn = toComplex(noutput_items, in, sampleFormat);
+
+  if (d_genSignalPDUs && pExtractor) {
+    sendNarrowbandPDUs(noutput_items, complexIn, signalVector, pMetadata);
+  } else if (d_genSignalPDUs && (signalVector.size() > 0)) {
+    pmt::pmt_t data_out(pmt::init_c32vector(noutput_items, complexIn));
 
     for (int i = 0; i < signalVector.size(); i++) {
       pmt::pmt_t meta = pmt::make_dict();
@@ -423,16 +618,180 @@ int SignalDetector_impl::processData(int noutput_items, const gr_complex *in,
     }
   }
 
-  return noutput_items;
+  return numOutputItems;
+}
+
+void SignalDetector_impl::sendNarrowbandPDUs(int noutput_items,
+                                             const gr_complex *in,
+                                             SignalOverviewVector &signalVector,
+                                             pmt::pmt_t *pMetadata) {
+  if (signalVector.size() == 0)
+    return;
+
+  ExtractedSignalVector signals(signalVector.size());
+
+  for (int i = 0; i < signalVector.size(); i++) {
+    signals[i].offsetHz = signalVector[i].centerFreqHz - d_centerFreq;
+    signals[i].widthHz = signalVector[i].widthHz;
+  }
+
+  // One pass through the data for all of the signals
+  pExtractor->extract(in, noutput_items, signals);
+
+  for (int i = 0; i < signals.size(); i++) {
+    // Start from the incoming metadata if we have it, but the rate and
+    // frequency fields describe the extracted signal now so they're always
+    // set.
+    pmt::pmt_t meta;
+
+    if (pMetadata)
+      meta = *pMetadata;
+    else
+      meta = pmt::make_dict();
+
+    if (!pmt::dict_has_key(meta, pmt::mp("radioFreq")))
+      meta = pmt::dict_add(meta, pmt::mp("radioFreq"), pmt::mp(d_centerFreq));
+
+    meta = pmt::dict_add(meta, pmt::mp("sampleRate"),
+                         pmt::mp(signals[i].sampleRate));
+    meta = pmt::dict_add(meta, pmt::mp("inputSampleRate"),
+                         pmt::mp(d_sampleRate));
+    meta = pmt::dict_add(meta, pmt::mp("decimation"),
+                         pmt::mp(signals[i].decimation));
+    meta = pmt::dict_add(meta, pmt::mp("signalCenterFreq"),
+                         pmt::mp(signalVector[i].centerFreqHz));
+    meta = pmt::dict_add(meta, pmt::mp("tunedFreq"),
+                         pmt::mp(d_centerFreq + signals[i].tunedOffsetHz));
+    meta = pmt::dict_add(meta, pmt::mp("widthHz"),
+                         pmt::mp(signalVector[i].widthHz));
+    meta = pmt::dict_add(meta, pmt::mp("maxPower"),
+                         pmt::mp(signalVector[i].maxPower));
+
+    ComplexVector &data = signals[i].data;
+    pmt::pmt_t data_out;
+
+    if (data.size() > 0)
+      data_out = pmt::init_c32vector(data.size(), &data[0]);
+    else
+      data_out = pmt::make_c32vector(0, gr_complex(0.0, 0.0));
+
+    pmt::pmt_t pdu = pmt::cons(meta, data_out);
+    message_port_pub(pmt::mp("signals"), pdu);
+  }
+}
+
+void SignalDetector_impl::addDetectionTags(uint64_t offset, int numSignals,
+                                           double centerFreq, double widthHz,
+                                           float maxPower) {
+  add_item_tag(0, offset, tagKeys.detect, pmt::PMT_T);
+  add_item_tag(0, offset, tagKeys.numSignals, pmt::from_long(numSignals));
+  add_item_tag(0, offset, tagKeys.signalCenterFreq,
+               pmt::from_double(centerFreq));
+  add_item_tag(0, offset, tagKeys.widthHz, pmt::from_double(widthHz));
+  add_item_tag(0, offset, tagKeys.maxPower, pmt::from_float(maxPower));
+}
+
+int SignalDetector_impl::getFFTSize() const { return d_fftSize; }
+
+void SignalDetector_impl::setFFTSize(int newValue) {
+  gr::thread::scoped_lock guard(d_mutex);
+
+  if (newValue == d_requestedFFTSize)
+    return;
+
+  // The flowgraph's buffers were sized for the startup block size, so an FFT
+  // frame can't be bigger than that.  The DC swap needs an even size.
+  if ((newValue < 2) || ((newValue % 2) != 0) || (newValue > d_blockSize)) {
+    throw std::out_of_range("[SignalDetector] FFT size must be even and no "
+                            "larger than the startup block size");
+  }
+
+  d_requestedFFTSize = newValue;
+
+  // The new FFT is planned here, not in work().  It's swapped in at the
+  // start of the next block.  Holding d_mutex keeps work() from swapping
+  // out the analyzer it's built from.
+  analyzerReconfig.queue(pEnergyAnalyzer, d_requestedFFTSize, d_windowType);
+}
+
+int SignalDetector_impl::getWindowType() const { return d_windowType; }
+
+void SignalDetector_impl::setWindowType(int newValue) {
+  gr::thread::scoped_lock guard(d_mutex);
+
+  if (newValue == d_windowType)
+    return;
+
+  if ((newValue < WINDOWTYPE_NONE) || (newValue > WINDOWTYPE_BLACKMAN_HARRIS))
+    throw std::out_of_range("[SignalDetector] Unknown window type");
+
+  d_windowType = newValue;
+  analyzerReconfig.queue(pEnergyAnalyzer, d_requestedFFTSize, d_windowType);
+}
+
+void SignalDetector_impl::applyReconfig() {
+  // Called with d_mutex held, so this is always on a block boundary.
+  if (!analyzerReconfig.swap(pEnergyAnalyzer))
+    return;
+
+  d_fftSize = pEnergyAnalyzer->getFFTSize();
+
+  // Average as many frames as fit in the startup block size
+  d_framesToAvg = d_blockSize / d_fftSize;
+
+  if (d_framesToAvg < 1)
+    d_framesToAvg = 1;
+
+  gr::block::set_output_multiple(d_fftSize * d_framesToAvg);
+}
+
+void SignalDetector_impl::forwardTags(int numItems) {
+  // Input tags for the block we're about to produce go along with it.
+  std::vector<gr::tag_t> tags;
+  uint64_t readStart = nitems_read(0);
+  get_tags_in_range(tags, 0, readStart, readStart + numItems);
+
+  uint64_t writeStart = nitems_written(0);
+
+  for (size_t i = 0; i < tags.size(); i++) {
+    tags[i].offset = tags[i].offset - readStart + writeStart;
+    add_item_tag(0, tags[i]);
+  }
+}
+
+void SignalDetector_impl::forecast(int noutput_items,
+                                   gr_vector_int &ninput_items_required) {
+  // Same number of input items as output items whether or not we produce
+  // them.
+  ninput_items_required[0] = noutput_items;
 }
 
-int SignalDetector_impl::work(int noutput_items,
-                              gr_vector_const_void_star &input_items,
-                              gr_vector_void_star &output_items) {
-  const gr_complex *in = (const gr_complex *)input_items[0];
-  gr_complex *out = (gr_complex *)output_items[0];
+int SignalDetector_impl::general_work(int noutput_items,
+                                      gr_vector_int &ninput_items,
+                                      gr_vector_const_void_star &input_items,
+                                      gr_vector_void_star &output_items) {
+  const void *in = input_items[0];
+  void *out = output_items[0];
 
-  return processData(noutput_items, in, out, NULL);
+  // Swap in a new FFT size first so the block is cut to the new size.  The
+  // lock is held through processData so the size can't change under us.
+  gr::thread::scoped_lock guard(d_mutex);
+  applyReconfig();
+
+  // Only whole blocks of fftSize * framesToAvg get analyzed
+  int blockSize = d_fftSize * d_framesToAvg;
+  int numItems = std::min(noutput_items, ninput_items[0]);
+  numItems -= numItems % blockSize;
+
+  if (numItems <= 0)
+    return 0;
+
+  int numOutputItems = processData(numItems, in, d_inputType, out, NULL);
+
+  consume_each(numItems);
+
+  // Tell runtime system how many output items we produced.
+  return numOutputItems;
 } // end work
 
 } /* namespace mesa */
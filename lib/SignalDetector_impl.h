@@ -21,6 +21,7 @@
 #ifndef INCLUDED_MESA_SIGNALDETECTOR_IMPL_H
 #define INCLUDED_MESA_SIGNALDETECTOR_IMPL_H
 
+#include "detection_tags_mesa.h"
 #include "signals_mesa.h"
 #include <chrono>
 #include <ctime>
@@ -31,6 +32,17 @@ using namespace MesaSignals;
 #define SIGDETECTOR_METHOD_SEPARATESIGNALS 1
 #define SIGDETECTOR_METHOD_BOXOUTSIDEIN 2
 
+// Continuous always produces a sample for every input sample (zeros when
+// there's no signal).  Gated only produces samples while a signal is
+// detected (including the hold time) and tags the bursts with sob/eob.
+#define SIGDETECTOR_OUTPUT_CONTINUOUS 1
+#define SIGDETECTOR_OUTPUT_GATED 2
+
+// Signal PDUs can carry the whole input block, or just the detected signal
+// tuned to baseband, filtered, and decimated.
+#define SIGDETECTOR_PDU_FULLBLOCK 1
+#define SIGDETECTOR_PDU_NARROWBAND 2
+
 namespace gr {
 namespace mesa {
 
@@ -53,6 +65,29 @@ protected:
   bool d_enableDebug;
 
   bool d_genSignalPDUs;
+  int d_outputMode;
+  int d_pduMode;
+  SignalExtractor *pExtractor;
+
+  int d_detectionOutput;
+  const DetectionTagKeys &tagKeys;
+
+  // Runtime FFT size / window changes.  d_blockSize is the analysis block
+  // size the flowgraph's buffers were sized for at startup.  Later FFT sizes
+  // average as many frames as fit in it.
+  AnalyzerReconfig analyzerReconfig;
+  int d_blockSize;
+  int d_requestedFFTSize;
+  int d_windowType;
+  void applyReconfig();
+
+  // SAMPLE_FORMAT_* of the stream input and output.  Message input is always
+  // complex.  Integer input is only converted to complex for signal PDU's.
+  int d_inputType;
+  SComplex *complexBuffer;
+  int complexBufferSize;
+  const gr_complex *toComplex(int noutput_items, const void *in,
+                              int sampleFormat);
 
   std::chrono::time_point<std::chrono::steady_clock> startup, endup;
   bool d_startInitialized;
@@ -60,16 +95,26 @@ protected:
 
   // Methods
   float calcMinDutyCycle();
-  virtual int processData(int noutput_items, const gr_complex *in,
-                          gr_complex *out, pmt::pmt_t *pMetadata);
+  virtual int processData(int noutput_items, const void *in,
+                          int sampleFormat, void *out, pmt::pmt_t *pMetadata);
   void sendState(bool state);
+  void forwardTags(int numItems);
+  void addDetectionTags(uint64_t offset, int numSignals, double centerFreq,
+                        double widthHz, float maxPower);
+  void sendNarrowbandPDUs(int noutput_items, const gr_complex *in,
+                          SignalOverviewVector &signalVector,
+                          pmt::pmt_t *pMetadata);
 
 public:
   SignalDetector_impl(int fftsize, float squelchThreshold, double minWidthHz,
                       double maxWidthHz, double radioCenterFreq,
                       double sampleRate, float holdUpSec, int framesToAvg,
                       bool genSignalPDUs, bool enableDebug,
-                      int detectionMethod);
+                      int detectionMethod, int analyzeFrames, int frameStride,
+                      bool adaptiveAnalysis,
+                      const std::string &sharedSpectrum, int outputMode,
+                      int pduMode, int detectionOutput, int inputType,
+                      int windowType);
   virtual ~SignalDetector_impl();
 
   virtual bool stop();
@@ -88,9 +133,18 @@ public:
   virtual double getMaxWidthHz() const;
   virtual void setMaxWidthHz(double newValue);
 
+  virtual int getFFTSize() const;
+  virtual void setFFTSize(int newValue);
+
+  virtual int getWindowType() const;
+  virtual void setWindowType(int newValue);
+
+  void forecast(int noutput_items, gr_vector_int &ninput_items_required);
+
   // Where all the action really happens
-  int work(int noutput_items, gr_vector_const_void_star &input_items,
-           gr_vector_void_star &output_items);
+  int general_work(int noutput_items, gr_vector_int &ninput_items,
+                   gr_vector_const_void_star &input_items,
+                   gr_vector_void_star &output_items);
 };
 
 } // namespace mesa
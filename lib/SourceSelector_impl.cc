@@ -29,54 +29,121 @@ namespace gr {
 namespace mesa {
 
 SourceSelector::sptr SourceSelector::make(float holdTime, int numInputs,
-                                          int defaultInput,
-                                          int inputBlockSize) {
+                                          int defaultInput, int inputBlockSize,
+                                          int queueDepth, int underrunPolicy,
+                                          int alignmentWindow) {
   return gnuradio::get_initial_sptr(new SourceSelector_impl(
-      holdTime, numInputs, defaultInput, inputBlockSize));
+      holdTime, numInputs, defaultInput, inputBlockSize, queueDepth,
+      underrunPolicy, alignmentWindow));
 }
 
 /*
  * The private constructor
  */
 SourceSelector_impl::SourceSelector_impl(float holdTime, int numInputs,
-                                         int defaultInput, int inputBlockSize)
+                                         int defaultInput, int inputBlockSize,
+                                         int queueDepth, int underrunPolicy,
+                                         int alignmentWindow)
     : gr::sync_block("SourceSelector", gr::io_signature::make(0, 0, 0),
                      gr::io_signature::make(0, 1, sizeof(gr_complex))) {
+  if (numInputs < 1)
+    throw std::out_of_range("[Source Selector] numInputs must be at least 1.");
+
   d_holdTime = holdTime;
   d_numInputs = numInputs;
   d_defaultInput = defaultInput;
   d_inputBlockSize = inputBlockSize;
 
-  if (defaultInput <= 0)
+  if ((defaultInput <= 0) || (defaultInput > d_numInputs))
     defaultInput = 1;
   d_currentInput = defaultInput;
 
   d_startInitialized = false;
 
-  limitQueue = false;
+  d_underrunPolicy = underrunPolicy;
+  droppedSamples = 0;
 
   // Initial anti-jitter buffer
   minQueueLength = d_inputBlockSize * 2;
   initialDataQueueRequirement = d_inputBlockSize * 6;
   initialQueueSizeMet = false;
+  queueRequirement = initialDataQueueRequirement;
+
+  // queue depth is in samples.  0 means pick one for us.  Either way it has
+  // to hold at least the initial buffering requirement with room to spare or
+  // we'd never start producing.
+  long depth = queueDepth;
+  long minDepth = initialDataQueueRequirement * 2;
+
+  if (depth <= 0) {
+    depth = initialDataQueueRequirement * 4;
+  } else if (depth < minDepth) {
+    std::cout << "[Source Selector] Queue depth of " << queueDepth
+              << " samples is too small for the initial buffering.  Using "
+              << minDepth << " samples." << std::endl;
+    depth = minDepth;
+  }
+
+  dataQueue = new ComplexRingBuffer(depth);
 
   std::cout << "[Source Selector] Buffering initial frames..." << std::endl;
 
-  for (int i = 0; i < 4; i++)
-    maxPower[i] = -999.0;
-
-  message_port_register_in(pmt::mp("in1"));
-  set_msg_handler(pmt::mp("in1"),
-                  boost::bind(&SourceSelector_impl::handleMsgIn1, this, _1));
-  message_port_register_in(pmt::mp("in2"));
-  set_msg_handler(pmt::mp("in2"),
-                  boost::bind(&SourceSelector_impl::handleMsgIn2, this, _1));
-  message_port_register_in(pmt::mp("in3"));
-  set_msg_handler(pmt::mp("in3"),
-                  boost::bind(&SourceSelector_impl::handleMsgIn3, this, _1));
-  message_port_register_in(pmt::mp("in4"));
-  set_msg_handler(pmt::mp("in4"),
-                  boost::bind(&SourceSelector_impl::handleMsgIn4, this, _1));
+  maxPower.assign(d_numInputs, -999.0);
+
+  // Time alignment.  A window of 0 disables it.
+  d_alignmentWindow = alignmentWindow;
+  corrForward = NULL;
+  corrReverse = NULL;
+  refSpectrum = NULL;
+  corrMagnitude = NULL;
+  corrFFTSize = 0;
+
+  if (d_alignmentWindow > 0) {
+    // Zero-pad to at least twice the window so the circular correlation
+    // doesn't wrap around on itself.
+    corrFFTSize = 1;
+    while (corrFFTSize < (2 * d_alignmentWindow))
+      corrFFTSize <<= 1;
+
+    corrForward = new FFT(FFTDIRECTION_FORWARD, corrFFTSize);
+    corrReverse = new FFT(FFTDIRECTION_BACKWARD, corrFFTSize);
+
+    size_t memAlignment = volk_get_alignment();
+    refSpectrum = (SComplex *)volk_malloc(corrFFTSize * sizeof(SComplex),
+                                          memAlignment);
+    corrMagnitude =
+        (float *)volk_malloc(corrFFTSize * sizeof(float), memAlignment);
+  }
+
+  // History has to hold at least the correlation window and a full input
+  // block.  It'll grow later if larger blocks show up.
+  historySize = d_alignmentWindow;
+  if (historySize < (2 * d_inputBlockSize))
+    historySize = 2 * d_inputBlockSize;
+
+  history.assign(d_numInputs, (gr_complex *)NULL);
+  historyFill.assign(d_numInputs, 0);
+  samplesReceived.assign(d_numInputs, 0);
+
+  if ((d_alignmentWindow > 0) && (historySize > 0)) {
+    size_t memAlignment = volk_get_alignment();
+
+    for (int i = 0; i < d_numInputs; i++)
+      history[i] = (gr_complex *)volk_malloc(historySize * sizeof(gr_complex),
+                                             memAlignment);
+  }
+
+  queuedEnd = 0;
+  pendingSkip = 0;
+
+  // Ports are in1..inN
+  for (int i = 1; i <= d_numInputs; i++) {
+    pmt::pmt_t portName = pmt::mp("in" + std::to_string(i));
+
+    message_port_register_in(portName);
+    set_msg_handler(portName,
+                    [this, i](pmt::pmt_t msg) { this->handleMsg(msg, i); });
+  }
 
   message_port_register_out(pmt::mp("inputport"));
 
@@ -84,7 +151,41 @@ SourceSelector_impl::SourceSelector_impl(float holdTime, int numInputs,
     gr::block::set_output_multiple(inputBlockSize);
 }
 
-bool SourceSelector_impl::stop() { return true; }
+bool SourceSelector_impl::stop() {
+  if (dataQueue) {
+    delete dataQueue;
+    dataQueue = NULL;
+  }
+
+  if (corrForward) {
+    delete corrForward;
+    corrForward = NULL;
+  }
+
+  if (corrReverse) {
+    delete corrReverse;
+    corrReverse = NULL;
+  }
+
+  if (refSpectrum) {
+    volk_free(refSpectrum);
+    refSpectrum = NULL;
+  }
+
+  if (corrMagnitude) {
+    volk_free(corrMagnitude);
+    corrMagnitude = NULL;
+  }
+
+  for (int i = 0; i < history.size(); i++) {
+    if (history[i]) {
+      volk_free(history[i]);
+      history[i] = NULL;
+    }
+  }
+
+  return true;
+}
 
 /*
  * Our virtual destructor.
@@ -95,37 +196,168 @@ int SourceSelector_impl::maxPowerIndex() {
   int maxIndex = 0;
   float curMax = maxPower[0];
 
-  for (int i = 1; i < 4; i++) {
+  for (int i = 1; i < d_numInputs; i++) {
     if (maxPower[i] > curMax) {
       maxIndex = i;
+      curMax = maxPower[i];
     }
   }
 
   return maxIndex;
 }
 
-int SourceSelector_impl::getDataAvailable() {
-  gr::thread::scoped_lock guard(d_queuemutex);
-  return dataQueue.size();
+long SourceSelector_impl::getDataAvailable() { return dataQueue->size(); }
+
+void SourceSelector_impl::queueData(const gr_complex *data, long numSamples) {
+  if (numSamples <= 0)
+    return;
+
+  // Bulk copy the block in.  If work() has fallen behind far enough that
+  // the queue is full, whatever doesn't fit is dropped.
+  long queued = dataQueue->enqueue(data, numSamples);
+
+  if (queued < numSamples) {
+    if (droppedSamples == 0)
+      std::cout << "[Source Selector] Data queue full.  Dropping samples."
+                << std::endl;
+
+    droppedSamples += (numSamples - queued);
+  }
 }
 
-void SourceSelector_impl::queueData(pmt::pmt_t msg) {
-  // Since we removed the output, just return.
-  /*
-  pmt::pmt_t data = pmt::cdr(msg);
+void SourceSelector_impl::addHistory(int inputIndex, const gr_complex *data,
+                                     long numSamples) {
+  samplesReceived[inputIndex] += numSamples;
 
-  if (data == pmt::PMT_NIL)
-          return;
+  if (!history[inputIndex])
+    return;
 
-  size_t vecSize = pmt::length(data);
-  const gr_complex *cc_samples;
-  cc_samples = pmt::c32vector_elements(data,vecSize);
+  if (numSamples > historySize) {
+    // We always want at least the whole latest block in the history, so grow
+    // to fit.
+    size_t memAlignment = volk_get_alignment();
+    long newSize = 2 * numSamples;
+
+    for (int i = 0; i < d_numInputs; i++) {
+      gr_complex *newHistory = (gr_complex *)volk_malloc(
+          newSize * sizeof(gr_complex), memAlignment);
+
+      // Keep whatever we had, right-justified
+      if (historyFill[i] > 0)
+        memcpy(&newHistory[newSize - historyFill[i]],
+               &history[i][historySize - historyFill[i]],
+               historyFill[i] * sizeof(gr_complex));
+
+      volk_free(history[i]);
+      history[i] = newHistory;
+    }
 
-  // queue the data
-gr::thread::scoped_lock guard(d_queuemutex);
-  for (long i=0;i<vecSize;i++)
-          dataQueue.push(cc_samples[i]);
-  */
+    historySize = newSize;
+  }
+
+  // History is right-justified: the newest sample is always at
+  // history[historySize-1].
+  gr_complex *pHistory = history[inputIndex];
+  long keep = historySize - numSamples;
+
+  if (keep > historyFill[inputIndex])
+    keep = historyFill[inputIndex];
+
+  if (keep > 0)
+    memmove(&pHistory[historySize - numSamples - keep],
+            &pHistory[historySize - keep], keep * sizeof(gr_complex));
+
+  memcpy(&pHistory[historySize - numSamples], data,
+         numSamples * sizeof(gr_complex));
+
+  historyFill[inputIndex] = keep + numSamples;
+}
+
+long SourceSelector_impl::estimateDelay(int refIndex, int inputIndex) {
+  // Returns the lag L such that ref[n] lines up with input[n + L] where both
+  // are indexed from the start of the last d_alignmentWindow samples of each
+  // history.  Computed as IFFT(FFT(input) * conj(FFT(ref))) and picking the
+  // peak.
+  long halfFFT = corrFFTSize / 2;
+  size_t windowBytes = d_alignmentWindow * sizeof(SComplex);
+  size_t padBytes = (corrFFTSize - d_alignmentWindow) * sizeof(SComplex);
+
+  SComplex *fftIn = corrForward->getInputBuffer();
+  SComplex *fftOut = corrForward->getOutputBuffer();
+
+  memcpy(fftIn, &history[refIndex][historySize - d_alignmentWindow],
+         windowBytes);
+  memset(&fftIn[d_alignmentWindow], 0x00, padBytes);
+  corrForward->execute();
+  memcpy(refSpectrum, fftOut, corrFFTSize * sizeof(SComplex));
+
+  memcpy(fftIn, &history[inputIndex][historySize - d_alignmentWindow],
+         windowBytes);
+  memset(&fftIn[d_alignmentWindow], 0x00, padBytes);
+  corrForward->execute();
+
+  // Cross spectrum straight into the reverse FFT input
+  volk_32fc_x2_multiply_conjugate_32fc(corrReverse->getInputBuffer(), fftOut,
+                                       refSpectrum, corrFFTSize);
+  corrReverse->execute();
+
+  volk_32fc_magnitude_squared_32f(
+      corrMagnitude, corrReverse->getOutputBuffer(), corrFFTSize);
+
+  uint32_t peakIndex;
+  volk_32f_index_max_32u(&peakIndex, corrMagnitude, corrFFTSize);
+
+  // Upper half of the result is negative lags
+  long lag = peakIndex;
+  if (lag >= halfFFT)
+    lag -= corrFFTSize;
+
+  return lag;
+}
+
+void SourceSelector_impl::switchInput(int port, const gr_complex *data,
+                                      long numSamples) {
+  int newIndex = port - 1;
+  int oldIndex = d_currentInput - 1;
+
+  d_currentInput = port;
+  pendingSkip = 0;
+
+  if (!history[newIndex] || (historyFill[oldIndex] < d_alignmentWindow) ||
+      (historyFill[newIndex] < d_alignmentWindow)) {
+    // No alignment (or not enough history yet to correlate), so just start
+    // with this block.
+    queueData(data, numSamples);
+    queuedEnd = samplesReceived[newIndex];
+    return;
+  }
+
+  // Map the point where the old input left off to the new input's sample
+  // count: new = old + L + (received new - received old)
+  long lag = estimateDelay(oldIndex, newIndex);
+  long long startSample = queuedEnd + lag + samplesReceived[newIndex] -
+                          samplesReceived[oldIndex];
+
+  long long received = samplesReceived[newIndex];
+  long long oldestAvailable = received - historyFill[newIndex];
+
+  if (startSample >= received) {
+    // The new input is running behind.  Skip ahead in the next blocks we
+    // get from it.
+    pendingSkip = startSample - received;
+    queuedEnd = startSample;
+    return;
+  }
+
+  if (startSample < oldestAvailable) {
+    // Delay is larger than the history we have.  Best we can do is start
+    // with what we've got.
+    startSample = oldestAvailable;
+  }
+
+  long numToQueue = (long)(received - startSample);
+  queueData(&history[newIndex][historySize - numToQueue], numToQueue);
+  queuedEnd = received;
 }
 
 void SourceSelector_impl::sendNewPortMsg(int port) {
@@ -136,7 +368,20 @@ void SourceSelector_impl::sendNewPortMsg(int port) {
 }
 
 void SourceSelector_impl::handleMsg(pmt::pmt_t msg, int port) {
+  gr::thread::scoped_lock guard(d_mutex);
+
   pmt::pmt_t meta = pmt::car(msg);
+  pmt::pmt_t data = pmt::cdr(msg);
+
+  const gr_complex *cc_samples = NULL;
+  size_t vecSize = 0;
+
+  if (pmt::is_c32vector(data))
+    cc_samples = pmt::c32vector_elements(data, vecSize);
+
+  // Track every input's samples so we can line them up later.
+  if (vecSize > 0)
+    addHistory(port - 1, cc_samples, vecSize);
 
   // Take a look at max power to see what we want to do.
   float maxVal = pmt::to_float(
@@ -148,76 +393,77 @@ void SourceSelector_impl::handleMsg(pmt::pmt_t msg, int port) {
   // Get the port with the current max power
   int iMaxPowerPort = maxPowerIndex() + 1;
 
-  if ((d_currentInput == port) && (iMaxPowerPort == port)) {
-    // If the max power port is the current port, then we'll queue the data.
-    queueData(msg);
-  } else {
-    // Need to see what didn't match.  If we're not max, we don't care and we
-    // can just drop through The missing "else" to the if statement below.
-
-    if (iMaxPowerPort == port) {
-      // We're here because the max power port is not d_currentInput, it's this
-      // port.  Which means the max power port has changed.
-
-      // Need to check our hold-down timers
-      if (!d_startInitialized) {
-        // First time the port has changed.  Go ahead and move it as we may just
-        // be initializing.
-        d_startInitialized = true;
-        d_currentInput = port;
-        lastShifted =
-            std::chrono::steady_clock::now(); // Initialize the shifted timer.
-
-        // We haven't initialized prior to this, so this is locking on to the
-        // first max power.  It may Hop a bit as the engine starts here.
-        queueData(msg);
-        sendNewPortMsg(port);
-      } else {
-        float powerDiff =
-            fabs(maxPower[port - 1] - maxPower[d_currentInput - 1]);
-        float pctDiff = fabs(powerDiff / maxPower[d_currentInput - 1]) *
-                        100.0; // Convert to percent of maxPower
-
-        // we're initialized so let's see if we're within our holddown period.
-        std::chrono::time_point<std::chrono::steady_clock> curTimestamp =
-            std::chrono::steady_clock::now();
-        std::chrono::duration<double> elapsed_seconds =
-            curTimestamp - lastShifted;
-        if (elapsed_seconds.count() > (double)d_holdTime) {
-          d_currentInput = port;
-          lastShifted = curTimestamp; // Reset the shifted timer.
-          queueData(msg);
-          sendNewPortMsg(port);
-        } // elapsed_seconds
-          /*
-           * The else to this that drops through is that we're not the max port
-           * and we're within our hold-down   timer, so we're not allowed to shift.
-           * Which means we have to just drop the data.  So there's no queueing.
-           */
-      }   // else initialized
-
-    } // iMaxPower == port
-  }
-}
-
-void SourceSelector_impl::handleMsgIn1(pmt::pmt_t msg) { handleMsg(msg, 1); }
+  if (d_currentInput == port) {
+    // Current port keeps flowing until we actually switch away from it.
+    long skip = 0;
 
-void SourceSelector_impl::handleMsgIn2(pmt::pmt_t msg) { handleMsg(msg, 2); }
-
-void SourceSelector_impl::handleMsgIn3(pmt::pmt_t msg) { handleMsg(msg, 3); }
+    if (pendingSkip > 0) {
+      skip = (pendingSkip < (long long)vecSize) ? (long)pendingSkip
+                                                : (long)vecSize;
+      pendingSkip -= skip;
+    }
 
-void SourceSelector_impl::handleMsgIn4(pmt::pmt_t msg) { handleMsg(msg, 4); }
+    if ((long)vecSize > skip)
+      queueData(&cc_samples[skip], vecSize - skip);
+
+    queuedEnd = samplesReceived[port - 1];
+  } else if (iMaxPowerPort == port) {
+    // We're here because the max power port is not d_currentInput, it's this
+    // port.  Which means the max power port has changed.
+
+    // Need to check our hold-down timers
+    if (!d_startInitialized) {
+      // First time the port has changed.  Go ahead and move it as we may just
+      // be initializing.
+      d_startInitialized = true;
+      lastShifted =
+          std::chrono::steady_clock::now(); // Initialize the shifted timer.
+
+      // We haven't initialized prior to this, so this is locking on to the
+      // first max power.  It may Hop a bit as the engine starts here.
+      switchInput(port, cc_samples, vecSize);
+      sendNewPortMsg(port);
+    } else {
+      // we're initialized so let's see if we're within our holddown period.
+      std::chrono::time_point<std::chrono::steady_clock> curTimestamp =
+          std::chrono::steady_clock::now();
+      std::chrono::duration<double> elapsed_seconds =
+          curTimestamp - lastShifted;
+      if (elapsed_seconds.count() > (double)d_holdTime) {
+        lastShifted = curTimestamp; // Reset the shifted timer.
+        switchInput(port, cc_samples, vecSize);
+        sendNewPortMsg(port);
+      } // elapsed_seconds
+        /*
+         * The else to this that drops through is that we're not the current
+         * port and we're within our hold-down timer, so we're not allowed to
+         * shift. The current port's data is still what's queued.
+         */
+    }   // else initialized
+  }     // iMaxPower == port
+}
 
 int SourceSelector_impl::work(int noutput_items,
                               gr_vector_const_void_star &input_items,
                               gr_vector_void_star &output_items) {
-  int curQueueSize = getDataAvailable();
+  long curQueueSize = getDataAvailable();
 
   gr_complex *out = (gr_complex *)output_items[0];
 
-  if ((!initialQueueSizeMet && (curQueueSize < initialDataQueueRequirement)) ||
+  if ((!initialQueueSizeMet && (curQueueSize < queueRequirement)) ||
       (curQueueSize == 0)) {
-    // std::cout << "iU";
+    if (initialQueueSizeMet) {
+      // We ran dry.  Build back up a little before we start producing again
+      // so we don't stutter a block at a time.
+      initialQueueSizeMet = false;
+      queueRequirement = minQueueLength;
+    }
+
+    if (d_underrunPolicy == SOURCESELECTOR_UNDERRUN_WAIT) {
+      // Don't produce anything.  The scheduler will call back in.
+      return 0;
+    }
+
     // Return zeros to keep the flowgraph running
     memset((void *)out, 0x00, noutput_items * sizeof(gr_complex));
     return noutput_items;
@@ -225,16 +471,7 @@ int SourceSelector_impl::work(int noutput_items,
 
   initialQueueSizeMet = true;
 
-  int itemsProduced = noutput_items;
-
-  if (curQueueSize < noutput_items)
-    itemsProduced = curQueueSize;
-
-  gr::thread::scoped_lock guard(d_queuemutex);
-  for (long i = 0; i < itemsProduced; i++) {
-    out[i] = dataQueue.front();
-    dataQueue.pop();
-  }
+  int itemsProduced = dataQueue->dequeue(out, noutput_items);
 
   return itemsProduced;
 }
@@ -21,20 +21,24 @@
 #ifndef INCLUDED_MESA_SOURCESELECTOR_IMPL_H
 #define INCLUDED_MESA_SOURCESELECTOR_IMPL_H
 
+#include "ringbuffer_mesa.h"
+#include "signals_mesa.h"
 #include <chrono>
 #include <ctime>
 #include <mesa/SourceSelector.h>
 
-#include <queue>
-
 using namespace std;
+using namespace MesaSignals;
+
+// What work() does when the data queue runs dry
+#define SOURCESELECTOR_UNDERRUN_ZEROS 1
+#define SOURCESELECTOR_UNDERRUN_WAIT 2
 
 namespace gr {
 namespace mesa {
 class SourceSelector_impl : public SourceSelector {
 protected:
   boost::mutex d_mutex;
-  boost::mutex d_queuemutex;
   float d_holdTime;
   int d_numInputs;
   int d_defaultInput;
@@ -42,24 +46,55 @@ protected:
   int d_currentInput;
 
   // Data queue management
-  queue<gr_complex> dataQueue;
-  // long maxQueueSize;
-  bool limitQueue;
+  // The message handler is the only producer and work() the only consumer,
+  // so the queue doesn't need a lock.
+  ComplexRingBuffer *dataQueue;
+  int d_underrunPolicy;
+  long droppedSamples;
 
   long minQueueLength;
   long initialDataQueueRequirement;
   bool initialQueueSizeMet;
+  long queueRequirement;
 
   // Max Power for each input
-  float maxPower[4];
+  std::vector<float> maxPower;
+
+  // Time alignment between inputs
+  // Each input keeps a history of its most recent samples and a running
+  // count of samples received.  When we switch inputs, the delay between the
+  // old and new input is estimated by cross-correlating their histories so
+  // the new input picks up on the sample that lines up with where the old
+  // one left off.
+  int d_alignmentWindow;
+  int corrFFTSize;
+  FFT *corrForward;
+  FFT *corrReverse;
+  SComplex *refSpectrum;
+  float *corrMagnitude;
+
+  long historySize;
+  std::vector<gr_complex *> history;
+  std::vector<long> historyFill;
+  std::vector<long long> samplesReceived;
+
+  // Sample index (in the current input's sample count) following the last
+  // sample queued for output.
+  long long queuedEnd;
+  // Samples still to be discarded from the current input to reach the
+  // aligned switch point.
+  long long pendingSkip;
 
   bool d_startInitialized;
   std::chrono::time_point<std::chrono::steady_clock> lastShifted;
 
   int maxPowerIndex();
-  void queueData(pmt::pmt_t msg);
+  void queueData(const gr_complex *data, long numSamples);
+  void addHistory(int inputIndex, const gr_complex *data, long numSamples);
+  long estimateDelay(int refIndex, int inputIndex);
+  void switchInput(int port, const gr_complex *data, long numSamples);
 
-  int getDataAvailable();
+  long getDataAvailable();
 
   void sendNewPortMsg(int port);
 
@@ -67,15 +102,11 @@ protected:
 
 public:
   SourceSelector_impl(float holdTime, int numInputs, int defaultInput,
-                      int inputBlockSize);
+                      int inputBlockSize, int queueDepth, int underrunPolicy,
+                      int alignmentWindow);
   ~SourceSelector_impl();
   virtual bool stop();
 
-  void handleMsgIn1(pmt::pmt_t msg);
-  void handleMsgIn2(pmt::pmt_t msg);
-  void handleMsgIn3(pmt::pmt_t msg);
-  void handleMsgIn4(pmt::pmt_t msg);
-
   // Where all the action really happens
   int work(int noutput_items, gr_vector_const_void_star &input_items,
            gr_vector_void_star &output_items);
@@ -0,0 +1,63 @@
+/*
+ * detection_tags_mesa.h
+ *
+ *      Copyright 2019, Michael Piscopo
+ *
+ */
+
+#ifndef LIB_DETECTION_TAGS_MESA_H_
+#define LIB_DETECTION_TAGS_MESA_H_
+
+#include <pmt/pmt.h>
+
+// Where detection results go.  Messages are the original dict PDUs.  Tags are
+// stream tags on the output at the sample where the detection (or loss)
+// happened, which downstream blocks get in sync with the data and which
+// don't need a dict built per event.
+#define DETECTION_OUTPUT_MESSAGES 1
+#define DETECTION_OUTPUT_TAGS 2
+#define DETECTION_OUTPUT_BOTH 3
+
+namespace MesaSignals {
+
+/*
+ * Stream tag keys used by the detection blocks.  Interning a symbol takes a
+ * lock and a hash table lookup, so the keys are interned once here and shared
+ * rather than calling pmt::mp() on every tag.
+ */
+class DetectionTagKeys {
+public:
+  static const DetectionTagKeys &get() {
+    // Initialized once, thread-safe in C++11
+    static DetectionTagKeys keys;
+    return keys;
+  };
+
+  // detect is PMT_T when a signal is acquired and PMT_F when it's lost.
+  pmt::pmt_t detect;
+  pmt::pmt_t numSignals;
+  pmt::pmt_t signalCenterFreq;
+  pmt::pmt_t widthHz;
+  pmt::pmt_t maxPower;
+  pmt::pmt_t freqOffset;
+
+  // Burst boundaries (gated output)
+  pmt::pmt_t sob;
+  pmt::pmt_t eob;
+
+protected:
+  DetectionTagKeys() {
+    detect = pmt::string_to_symbol("detect");
+    numSignals = pmt::string_to_symbol("numsignals");
+    signalCenterFreq = pmt::string_to_symbol("signalCenterFreq");
+    widthHz = pmt::string_to_symbol("widthHz");
+    maxPower = pmt::string_to_symbol("maxPower");
+    freqOffset = pmt::string_to_symbol("freqoffset");
+    sob = pmt::string_to_symbol("sob");
+    eob = pmt::string_to_symbol("eob");
+  };
+};
+
+} // namespace MesaSignals
+
+#endif /* LIB_DETECTION_TAGS_MESA_H_ */
@@ -23,38 +23,82 @@
 #endif
 
 #include "ioselector_impl.h"
+#include <algorithm>
+#include <cstring>
 #include <gnuradio/io_signature.h>
 
 namespace gr {
 namespace mesa {
 
 ioselector::sptr ioselector::make(int numinputs, int numoutputs, int inputport,
-                                  int outputport, int itemsize) {
+                                  int outputport, int itemsize,
+                                  int unselectedOutput,
+                                  const std::vector<int> &routes,
+                                  int crossfadeSamples) {
   return gnuradio::get_initial_sptr(new ioselector_impl(
-      numinputs, numoutputs, inputport, outputport, itemsize));
+      numinputs, numoutputs, inputport, outputport, itemsize, unselectedOutput,
+      routes, crossfadeSamples));
 }
 
 /*
  * The private constructor
  */
 ioselector_impl::ioselector_impl(int numinputs, int numoutputs, int inputport,
-                                 int outputport, int itemsize)
-    : gr::sync_block("ioselector",
-                     gr::io_signature::make(1, numinputs, itemsize),
-                     gr::io_signature::make(1, numoutputs, itemsize)) {
+                                 int outputport, int itemsize,
+                                 int unselectedOutput,
+                                 const std::vector<int> &routes,
+                                 int crossfadeSamples)
+    : gr::block("ioselector", gr::io_signature::make(1, numinputs, itemsize),
+                gr::io_signature::make(1, numoutputs, itemsize)) {
   d_numinputs = numinputs;
   d_numoutputs = numoutputs;
   d_curInput = inputport;
   d_curOutput = outputport;
   d_itemsize = itemsize;
+  d_unselectedOutput = unselectedOutput;
+
+  // Crossfading blends samples as floats, so it only applies to float and
+  // complex (and vectors of them).
+  d_crossfadeSamples = crossfadeSamples;
+
+  if ((d_crossfadeSamples < 0) || ((d_itemsize % sizeof(float)) != 0))
+    d_crossfadeSamples = 0;
+
+  routeTable.assign(d_numoutputs, -1);
+  fadeFrom.assign(d_numoutputs, -1);
+  fadeRemaining.assign(d_numoutputs, 0);
+
+  d_crossbar = (routes.size() > 0);
+
+  if (d_crossbar) {
+    // Crossbar: start from the provided table
+    for (int i = 0; (i < (int)routes.size()) && (i < d_numoutputs); i++) {
+      if ((routes[i] >= 0) && (routes[i] < d_numinputs))
+        routeTable[i] = routes[i];
+    }
+  } else if ((outputport >= 0) && (outputport < d_numoutputs) &&
+             (inputport >= 0) && (inputport < d_numinputs)) {
+    // Classic single input to single output
+    routeTable[outputport] = inputport;
+  }
+
+  itemsProcessed = 0;
+
+  routeKey = pmt::mp("route");
+  offsetKey = pmt::mp("offset");
+
+  // Tags only follow the routed paths.  That's handled in general_work.
+  set_tag_propagation_policy(TPP_DONT);
 
   message_port_register_in(pmt::mp("inputindex"));
   set_msg_handler(pmt::mp("inputindex"),
-		  [this](pmt::pmt_t msg) { this->handleMsgInputIndex(msg); });
+                  [this](pmt::pmt_t msg) { this->handleMsgInputIndex(msg); });
   message_port_register_in(pmt::mp("outputindex"));
-  set_msg_handler(
-      pmt::mp("outputindex"),
-	  [this](pmt::pmt_t msg) { this->handleMsgOutputIndex(msg); });
+  set_msg_handler(pmt::mp("outputindex"),
+                  [this](pmt::pmt_t msg) { this->handleMsgOutputIndex(msg); });
+  message_port_register_in(pmt::mp("route"));
+  set_msg_handler(pmt::mp("route"),
+                  [this](pmt::pmt_t msg) { this->handleMsgRoute(msg); });
 }
 
 /*
@@ -84,21 +128,451 @@ void ioselector_impl::handleMsgOutputIndex(pmt::pmt_t msg) {
   }
 }
 
-void ioselector_impl::set_input_index(int newValue) { d_curInput = newValue; }
+void ioselector_impl::handleMsgRoute(pmt::pmt_t msg) {
+  // Accepts either a bare routing table or a PDU whose data is the routing
+  // table.  A PDU may carry an "offset" in its metadata with the absolute
+  // sample at which to switch.  Otherwise it switches at the start of the
+  // next work call.
+  pmt::pmt_t meta = pmt::PMT_NIL;
+  pmt::pmt_t data = msg;
+
+  if (pmt::is_pair(msg) &&
+      (pmt::is_dict(pmt::car(msg)) || pmt::is_null(pmt::car(msg)))) {
+    meta = pmt::car(msg);
+    data = pmt::cdr(msg);
+  }
+
+  std::vector<int> routes;
+
+  if (!parseRoutes(data, routes))
+    return;
+
+  gr::thread::scoped_lock guard(d_mutex);
+
+  uint64_t offset = itemsProcessed;
+
+  if (pmt::is_dict(meta) && pmt::dict_has_key(meta, offsetKey)) {
+    pmt::pmt_t offsetValue = pmt::dict_ref(meta, offsetKey, pmt::PMT_NIL);
+
+    if (pmt::is_integer(offsetValue))
+      offset = pmt::to_long(offsetValue);
+    else if (pmt::is_uint64(offsetValue))
+      offset = pmt::to_uint64(offsetValue);
+  }
+
+  d_crossbar = true;
+  queueRouteChange(offset, routes);
+}
+
+bool ioselector_impl::parseRoutes(pmt::pmt_t data, std::vector<int> &routes) {
+  routes.clear();
+
+  if (pmt::is_s32vector(data)) {
+    size_t len;
+    const int32_t *values = pmt::s32vector_elements(data, len);
+    routes.assign(values, values + len);
+  } else if (pmt::is_vector(data)) {
+    size_t len = pmt::length(data);
+
+    for (size_t i = 0; i < len; i++) {
+      pmt::pmt_t value = pmt::vector_ref(data, i);
+
+      if (!pmt::is_integer(value))
+        return false;
+
+      routes.push_back(pmt::to_long(value));
+    }
+  } else if (pmt::is_pair(data)) {
+    // list
+    while (pmt::is_pair(data)) {
+      pmt::pmt_t value = pmt::car(data);
+
+      if (!pmt::is_integer(value))
+        return false;
+
+      routes.push_back(pmt::to_long(value));
+      data = pmt::cdr(data);
+    }
+  } else {
+    return false;
+  }
+
+  sanitizeRoutes(routes);
+
+  return true;
+}
+
+void ioselector_impl::sanitizeRoutes(std::vector<int> &routes) {
+  // One entry per output.  Anything out of range is treated as unrouted.
+  routes.resize(d_numoutputs, -1);
+
+  for (int i = 0; i < d_numoutputs; i++) {
+    if ((routes[i] < 0) || (routes[i] >= d_numinputs))
+      routes[i] = -1;
+  }
+}
+
+void ioselector_impl::queueRouteChange(uint64_t offset,
+                                       const std::vector<int> &routes) {
+  // Caller holds d_mutex.  Keep the queue sorted by offset, and changes at
+  // the same offset in the order they arrived.
+  RouteChange change;
+  change.offset = offset;
+  change.routes = routes;
 
-void ioselector_impl::set_output_index(int newValue) { d_curOutput = newValue; }
+  std::deque<RouteChange>::iterator it = pendingChanges.begin();
 
-int ioselector_impl::work(int noutput_items,
-                          gr_vector_const_void_star &input_items,
-                          gr_vector_void_star &output_items) {
-  const char *in = (const char *)input_items[d_curInput];
-  char *out = (char *)output_items[d_curOutput];
+  while ((it != pendingChanges.end()) && (it->offset <= offset))
+    it++;
+
+  pendingChanges.insert(it, change);
+}
+
+void ioselector_impl::set_input_index(int newValue) {
+  gr::thread::scoped_lock guard(d_mutex);
+
+  d_curInput = newValue;
+
+  // A single index would wipe the rest of the crossbar
+  if (d_crossbar)
+    return;
+
+  std::vector<int> routes(d_numoutputs, -1);
+
+  if ((d_curOutput >= 0) && (d_curOutput < d_numoutputs) && (newValue >= 0) &&
+      (newValue < d_numinputs))
+    routes[d_curOutput] = newValue;
+
+  queueRouteChange(itemsProcessed, routes);
+}
+
+void ioselector_impl::set_output_index(int newValue) {
+  gr::thread::scoped_lock guard(d_mutex);
+
+  d_curOutput = newValue;
+
+  if (d_crossbar)
+    return;
+
+  std::vector<int> routes(d_numoutputs, -1);
+
+  if ((newValue >= 0) && (newValue < d_numoutputs) && (d_curInput >= 0) &&
+      (d_curInput < d_numinputs))
+    routes[newValue] = d_curInput;
+
+  queueRouteChange(itemsProcessed, routes);
+}
+
+void ioselector_impl::set_routes(const std::vector<int> &routes) {
+  std::vector<int> newRoutes(routes);
+  sanitizeRoutes(newRoutes);
+
+  gr::thread::scoped_lock guard(d_mutex);
+  d_crossbar = true;
+  queueRouteChange(itemsProcessed, newRoutes);
+}
+
+void ioselector_impl::applyRoutes(const std::vector<int> &routes) {
+  for (int i = 0; i < d_numoutputs; i++) {
+    if (routes[i] == routeTable[i])
+      continue;
+
+    if (d_crossfadeSamples > 0) {
+      // Blend from whatever this output is carrying right now
+      fadeFrom[i] = routeTable[i];
+      fadeRemaining[i] = d_crossfadeSamples;
+    }
+
+    routeTable[i] = routes[i];
+  }
+}
+
+void ioselector_impl::markActiveInputs(std::vector<bool> &active,
+                                       bool includeDue, int noutput_items) {
+  // An input is active if it feeds an output, is being faded out of an
+  // output, or (for forecasting) is about to be switched in.
+  int ninputs = active.size();
+  bool anyActive = false;
+
+  for (int i = 0; i < d_numoutputs; i++) {
+    if ((routeTable[i] >= 0) && (routeTable[i] < ninputs)) {
+      active[routeTable[i]] = true;
+      anyActive = true;
+    }
+
+    if ((fadeRemaining[i] > 0) && (fadeFrom[i] >= 0) &&
+        (fadeFrom[i] < ninputs)) {
+      active[fadeFrom[i]] = true;
+      anyActive = true;
+    }
+  }
+
+  if (includeDue) {
+    for (size_t c = 0; c < pendingChanges.size(); c++) {
+      if (pendingChanges[c].offset >= itemsProcessed + noutput_items)
+        break;
+
+      for (int i = 0; i < d_numoutputs; i++) {
+        int input = pendingChanges[c].routes[i];
+
+        if ((input >= 0) && (input < ninputs)) {
+          active[input] = true;
+          anyActive = true;
+        }
+      }
+    }
+  }
+
+  if (!anyActive) {
+    // Nothing routed.  Pace ourselves off all the inputs rather than
+    // spinning.
+    for (int i = 0; i < ninputs; i++)
+      active[i] = true;
+  }
+}
 
-  int noi = noutput_items * d_itemsize;
-  memcpy(out, in, noi);
+void ioselector_impl::forecast(int noutput_items,
+                               gr_vector_int &ninput_items_required) {
+  // Only the routed inputs have to have data for us to run.  Anything
+  // waiting on the other inputs just gets consumed as we go.
+  gr::thread::scoped_lock guard(d_mutex);
+
+  unsigned ninputs = ninput_items_required.size();
+  std::vector<bool> active(ninputs, false);
+
+  markActiveInputs(active, true, noutput_items);
+
+  for (unsigned i = 0; i < ninputs; i++) {
+    if (active[i])
+      ninput_items_required[i] = noutput_items;
+    else
+      ninput_items_required[i] = 0;
+  }
+}
+
+void ioselector_impl::forwardTags(int input, int output, int start, int end,
+                                  int outPos) {
+  std::vector<gr::tag_t> tags;
+  uint64_t readStart = nitems_read(input);
+  get_tags_in_range(tags, input, readStart + start, readStart + end);
+
+  uint64_t writeStart = nitems_written(output) + outPos;
+
+  for (size_t i = 0; i < tags.size(); i++) {
+    // Routing commands are for us, not downstream
+    if (pmt::eqv(tags[i].key, routeKey))
+      continue;
+
+    tags[i].offset = tags[i].offset - readStart - start + writeStart;
+    add_item_tag(output, tags[i]);
+  }
+}
+
+void ioselector_impl::copySegment(int output, int start, int end, int &outPos,
+                                  gr_vector_const_void_star &input_items,
+                                  gr_vector_void_star &output_items) {
+  if (end <= start)
+    return;
+
+  int ninputs = input_items.size();
+  int input = routeTable[output];
+
+  if (input >= ninputs)
+    input = -1;
+
+  char *out = (char *)output_items[output];
+  int curItem = start;
+
+  if (fadeRemaining[output] > 0) {
+    // Crossfade: out = from + gain * (to - from) with the gain ramping up to 1
+    // across the fade.  An unrouted side contributes zeros.
+    int from = fadeFrom[output];
+
+    if (from >= ninputs)
+      from = -1;
+
+    int floatsPerItem = d_itemsize / sizeof(float);
+    const float *fromIn = NULL;
+    const float *toIn = NULL;
+    float *fadeOut = (float *)out;
+
+    if (from >= 0)
+      fromIn = (const float *)input_items[from];
+
+    if (input >= 0)
+      toIn = (const float *)input_items[input];
+
+    int fadeStart = curItem;
+    int fadeOutPos = outPos;
+
+    while ((curItem < end) && (fadeRemaining[output] > 0)) {
+      float gain = (float)(d_crossfadeSamples - fadeRemaining[output] + 1) /
+                   (float)(d_crossfadeSamples + 1);
+
+      for (int j = 0; j < floatsPerItem; j++) {
+        float a = fromIn ? fromIn[curItem * floatsPerItem + j] : 0.0;
+        float b = toIn ? toIn[curItem * floatsPerItem + j] : 0.0;
+
+        fadeOut[outPos * floatsPerItem + j] = a + gain * (b - a);
+      }
+
+      curItem++;
+      outPos++;
+      fadeRemaining[output]--;
+    }
+
+    if (input >= 0)
+      forwardTags(input, output, fadeStart, curItem, fadeOutPos);
+  }
+
+  int numItems = end - curItem;
+
+  if (numItems <= 0)
+    return;
+
+  if (input >= 0) {
+    // Routed: one straight copy and the tags that go with it.
+    const char *in = (const char *)input_items[input];
+
+    memcpy(&out[outPos * d_itemsize], &in[curItem * d_itemsize],
+           numItems * d_itemsize);
+
+    forwardTags(input, output, curItem, end, outPos);
+    outPos += numItems;
+  } else if (d_unselectedOutput == IOSELECTOR_UNSELECTED_ZEROS) {
+    memset(&out[outPos * d_itemsize], 0x00, numItems * d_itemsize);
+    outPos += numItems;
+  }
+}
+
+int ioselector_impl::general_work(int noutput_items,
+                                  gr_vector_int &ninput_items,
+                                  gr_vector_const_void_star &input_items,
+                                  gr_vector_void_star &output_items) {
+  gr::thread::scoped_lock guard(d_mutex);
+
+  int ninputs = input_items.size();
+  int noutputs = output_items.size();
+
+  // Run as far as the routed inputs allow
+  std::vector<bool> active(ninputs, false);
+  markActiveInputs(active, false, noutput_items);
+
+  int numItems = noutput_items;
+
+  for (int i = 0; i < ninputs; i++) {
+    if (active[i] && (ninput_items[i] < numItems))
+      numItems = ninput_items[i];
+  }
+
+  // Gather the route changes that land in this call.  Offsets become
+  // relative to the start of this call.
+  std::vector<RouteChange> changes;
+
+  for (size_t c = 0; c < pendingChanges.size(); c++) {
+    if (pendingChanges[c].offset >= itemsProcessed + numItems)
+      break;
+
+    RouteChange change = pendingChanges[c];
+
+    if (change.offset > itemsProcessed)
+      change.offset -= itemsProcessed;
+    else
+      change.offset = 0; // late.  Switch now.
+
+    changes.push_back(change);
+  }
+
+  // Route tags on any input switch at the tagged sample.
+  for (int i = 0; i < ninputs; i++) {
+    int avail = std::min(numItems, ninput_items[i]);
+
+    if (avail <= 0)
+      continue;
+
+    std::vector<gr::tag_t> tags;
+    uint64_t readStart = nitems_read(i);
+    get_tags_in_range(tags, i, readStart, readStart + avail, routeKey);
+
+    for (size_t t = 0; t < tags.size(); t++) {
+      RouteChange change;
+
+      if (!parseRoutes(tags[t].value, change.routes))
+        continue;
+
+      change.offset = tags[t].offset - readStart;
+      changes.push_back(change);
+      d_crossbar = true;
+    }
+  }
+
+  std::stable_sort(changes.begin(), changes.end(),
+                   [](const RouteChange &a, const RouteChange &b) {
+                     return a.offset < b.offset;
+                   });
+
+  // Copy each stretch between route changes with the table in effect for it.
+  std::vector<int> outPos(noutputs, 0);
+  int segStart = 0;
+
+  for (size_t c = 0; c < changes.size(); c++) {
+    int changeAt = changes[c].offset;
+
+    if (changeAt >= numItems)
+      break;
+
+    for (int o = 0; o < noutputs; o++)
+      copySegment(o, segStart, changeAt, outPos[o], input_items, output_items);
+
+    segStart = changeAt;
+
+    // Make sure the newly routed inputs have data past the switch.  If not,
+    // stop right at it and pick it up next call.
+    int avail = numItems;
+
+    for (int o = 0; o < noutputs; o++) {
+      int input = changes[c].routes[o];
+
+      if ((input >= 0) && (input < ninputs) && (ninput_items[input] < avail))
+        avail = ninput_items[input];
+    }
+
+    if (avail <= changeAt) {
+      numItems = changeAt;
+      break;
+    }
+
+    numItems = avail;
+
+    applyRoutes(changes[c].routes);
+  }
+
+  for (int o = 0; o < noutputs; o++)
+    copySegment(o, segStart, numItems, outPos[o], input_items, output_items);
+
+  for (int o = 0; o < noutputs; o++)
+    produce(o, outPos[o]);
+
+  // Inputs that aren't routed are dropped without being touched, keeping
+  // pace with the routed inputs.
+  for (int i = 0; i < ninputs; i++) {
+    if (ninput_items[i] < numItems)
+      consume(i, ninput_items[i]);
+    else
+      consume(i, numItems);
+  }
+
+  if (numItems > 0) {
+    itemsProcessed += numItems;
+
+    // Queued changes we've now passed have been applied
+    while ((pendingChanges.size() > 0) &&
+           (pendingChanges.front().offset < itemsProcessed))
+      pendingChanges.pop_front();
+  }
 
-  // Tell runtime system how many output items we produced.
-  return noutput_items;
+  // Tell runtime system we used produce() per output
+  return WORK_CALLED_PRODUCE;
 }
 
 } /* namespace mesa */
@@ -21,34 +21,86 @@
 #ifndef INCLUDED_MESA_IOSELECTOR_IMPL_H
 #define INCLUDED_MESA_IOSELECTOR_IMPL_H
 
+#include <boost/thread/mutex.hpp>
+#include <deque>
 #include <mesa/ioselector.h>
 
+// What the outputs that aren't selected do
+#define IOSELECTOR_UNSELECTED_NOTHING 1
+#define IOSELECTOR_UNSELECTED_ZEROS 2
+
 namespace gr {
 namespace mesa {
 
+// A routing table waiting to be applied at an absolute sample offset
+struct RouteChange {
+  uint64_t offset;
+  std::vector<int> routes;
+};
+
 class ioselector_impl : public ioselector {
 private:
-  // Nothing to declare in this block.
   int d_numinputs;
   int d_numoutputs;
   int d_curInput;
   int d_curOutput;
   int d_itemsize;
+  int d_unselectedOutput;
+  int d_crossfadeSamples;
+
+  boost::mutex d_mutex;
+
+  // routeTable[output] = input feeding it, or -1 for none
+  std::vector<int> routeTable;
+
+  // Set once a routing table has been given (at startup, set_routes, the
+  // route port, or a route tag).  From then on the table owns the routing
+  // and input/output index changes are only recorded.
+  bool d_crossbar;
+
+  // Crossfade state per output.  While fadeRemaining > 0 the output blends
+  // from fadeFrom into the current route.
+  std::vector<int> fadeFrom;
+  std::vector<int> fadeRemaining;
+
+  // Samples processed since start.  Timed route changes are against this.
+  uint64_t itemsProcessed;
+  std::deque<RouteChange> pendingChanges;
+
+  pmt::pmt_t routeKey;
+  pmt::pmt_t offsetKey;
+
+  bool parseRoutes(pmt::pmt_t data, std::vector<int> &routes);
+  void sanitizeRoutes(std::vector<int> &routes);
+  void queueRouteChange(uint64_t offset, const std::vector<int> &routes);
+  void applyRoutes(const std::vector<int> &routes);
+  void markActiveInputs(std::vector<bool> &active, bool includeDue,
+                        int noutput_items);
+  void copySegment(int output, int start, int end, int &outPos,
+                   gr_vector_const_void_star &input_items,
+                   gr_vector_void_star &output_items);
+  void forwardTags(int input, int output, int start, int end, int outPos);
 
 public:
   ioselector_impl(int numinputs, int numoutputs, int inputport, int outputport,
-                  int itemsize);
+                  int itemsize, int unselectedOutput,
+                  const std::vector<int> &routes, int crossfadeSamples);
   ~ioselector_impl();
 
   virtual void set_input_index(int newValue);
   virtual void set_output_index(int newValue);
+  virtual void set_routes(const std::vector<int> &routes);
 
   void handleMsgInputIndex(pmt::pmt_t msg);
   void handleMsgOutputIndex(pmt::pmt_t msg);
+  void handleMsgRoute(pmt::pmt_t msg);
+
+  void forecast(int noutput_items, gr_vector_int &ninput_items_required);
 
   // Where all the action really happens
-  int work(int noutput_items, gr_vector_const_void_star &input_items,
-           gr_vector_void_star &output_items);
+  int general_work(int noutput_items, gr_vector_int &ninput_items,
+                   gr_vector_const_void_star &input_items,
+                   gr_vector_void_star &output_items);
 };
 
 } // namespace mesa
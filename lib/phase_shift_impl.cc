@@ -30,23 +30,38 @@
 namespace gr {
 namespace mesa {
 
-phase_shift::sptr phase_shift::make(float shift_in_radians) {
-  return gnuradio::get_initial_sptr(new phase_shift_impl(shift_in_radians));
+phase_shift::sptr phase_shift::make(float shift_in_radians,
+                                    float ramp_rad_per_sample) {
+  return gnuradio::get_initial_sptr(
+      new phase_shift_impl(shift_in_radians, ramp_rad_per_sample));
 }
 
 /*
  * The private constructor
  */
-phase_shift_impl::phase_shift_impl(float shift_in_radians)
+phase_shift_impl::phase_shift_impl(float shift_in_radians,
+                                   float ramp_rad_per_sample)
     : gr::sync_block("phase_shift",
                      gr::io_signature::make(1, 1, sizeof(gr_complex)),
                      gr::io_signature::make(1, 1, sizeof(gr_complex))) {
   d_shift_in_radians = shift_in_radians;
-  d_shift_cc = gr_complex(cos(d_shift_in_radians), sin(d_shift_in_radians));
+  d_ramp = ramp_rad_per_sample;
+  d_phaseAccum = 0.0;
+
+  d_lastParams = packParams(d_shift_in_radians, d_ramp);
+  d_params.store(d_lastParams);
+
+  phaseKey = pmt::mp("phase");
+  phaseStepKey = pmt::mp("phase_step");
+  phaseRampKey = pmt::mp("phase_ramp");
 
   message_port_register_in(pmt::mp("shift_rad"));
   set_msg_handler(pmt::mp("shift_rad"),
                   [this](pmt::pmt_t msg) { this->handle_msg_in(msg); });
+
+  message_port_register_in(pmt::mp("ramp_rad"));
+  set_msg_handler(pmt::mp("ramp_rad"),
+                  [this](pmt::pmt_t msg) { this->handle_ramp_msg_in(msg); });
 }
 
 /*
@@ -54,16 +69,113 @@ phase_shift_impl::phase_shift_impl(float shift_in_radians)
  */
 phase_shift_impl::~phase_shift_impl() {}
 
+uint64_t phase_shift_impl::packParams(float shift, float ramp) {
+  uint32_t shiftBits;
+  uint32_t rampBits;
+
+  memcpy(&shiftBits, &shift, sizeof(shiftBits));
+  memcpy(&rampBits, &ramp, sizeof(rampBits));
+
+  return ((uint64_t)rampBits << 32) | (uint64_t)shiftBits;
+}
+
+void phase_shift_impl::unpackParams(uint64_t packed, float &shift,
+                                    float &ramp) {
+  uint32_t shiftBits = (uint32_t)(packed & 0xFFFFFFFF);
+  uint32_t rampBits = (uint32_t)(packed >> 32);
+
+  memcpy(&shift, &shiftBits, sizeof(shift));
+  memcpy(&ramp, &rampBits, sizeof(ramp));
+}
+
 void phase_shift_impl::handle_msg_in(pmt::pmt_t msg) {
   set_shift(pmt::to_float(msg));
 }
 
-float phase_shift_impl::get_shift() const { return d_shift_in_radians; }
+void phase_shift_impl::handle_ramp_msg_in(pmt::pmt_t msg) {
+  set_ramp(pmt::to_float(msg));
+}
+
+float phase_shift_impl::get_shift() const {
+  float shift, ramp;
+  unpackParams(d_params.load(std::memory_order_acquire), shift, ramp);
+  return shift;
+}
 
 void phase_shift_impl::set_shift(float newValue) {
-  gr::thread::scoped_lock guard(d_setlock);
-  d_shift_in_radians = newValue;
-  d_shift_cc = gr_complex(cos(d_shift_in_radians), sin(d_shift_in_radians));
+  uint64_t oldParams = d_params.load(std::memory_order_acquire);
+  float shift, ramp;
+
+  do {
+    unpackParams(oldParams, shift, ramp);
+  } while (!d_params.compare_exchange_weak(oldParams,
+                                           packParams(newValue, ramp),
+                                           std::memory_order_acq_rel));
+}
+
+float phase_shift_impl::get_ramp() const {
+  float shift, ramp;
+  unpackParams(d_params.load(std::memory_order_acquire), shift, ramp);
+  return ramp;
+}
+
+void phase_shift_impl::set_ramp(float newValue) {
+  uint64_t oldParams = d_params.load(std::memory_order_acquire);
+  float shift, ramp;
+
+  do {
+    unpackParams(oldParams, shift, ramp);
+  } while (!d_params.compare_exchange_weak(oldParams,
+                                           packParams(shift, newValue),
+                                           std::memory_order_acq_rel));
+}
+
+void phase_shift_impl::storeTagRamp(float newRamp) {
+  // A phase_ramp tag goes into the shared parameters too, so get_ramp()
+  // reports it and a later set_shift() keeps it instead of the old ramp.
+  uint64_t oldParams = d_params.load(std::memory_order_acquire);
+  uint64_t newParams;
+  float shift, ramp;
+
+  do {
+    unpackParams(oldParams, shift, ramp);
+    newParams = packParams(shift, newRamp);
+  } while (!d_params.compare_exchange_weak(oldParams, newParams,
+                                           std::memory_order_acq_rel));
+
+  // If another thread changed the parameters since work() last picked them
+  // up, leave d_lastParams alone so the next call applies their change.
+  if (oldParams == d_lastParams)
+    d_lastParams = newParams;
+}
+
+void phase_shift_impl::rotate(const gr_complex *in, gr_complex *out,
+                              int numItems) {
+  if (numItems <= 0)
+    return;
+
+  double phase = (double)d_shift_in_radians + d_phaseAccum;
+
+  if (d_ramp == 0.0) {
+    // Constant shift
+    if (phase != 0.0) {
+      gr_complex shift_cc = gr_complex(cos(phase), sin(phase));
+      volk_32fc_s32fc_multiply_32fc(out, in, shift_cc, numItems);
+    } else {
+      memcpy(out, in, sizeof(gr_complex) * numItems);
+    }
+  } else {
+    // Ramp: one pass through the rotator starting at the current phase.
+    // The starting phase is recomputed from the double accumulator each
+    // call so the rotator's magnitude error never builds up.
+    lv_32fc_t curPhase = lv_cmake(cos(phase), sin(phase));
+    lv_32fc_t phaseInc = lv_cmake(cos(d_ramp), sin(d_ramp));
+
+    volk_32fc_s32fc_x2_rotator_32fc(out, in, phaseInc, &curPhase, numItems);
+
+    d_phaseAccum =
+        fmod(d_phaseAccum + (double)d_ramp * (double)numItems, 2.0 * M_PI);
+  }
 }
 
 int phase_shift_impl::work(int noutput_items,
@@ -72,14 +184,51 @@ int phase_shift_impl::work(int noutput_items,
   const gr_complex *in = (const gr_complex *)input_items[0];
   gr_complex *out = (gr_complex *)output_items[0];
 
-  gr::thread::scoped_lock guard(d_setlock);
+  // Pick up any parameter change.  No lock needed.
+  uint64_t params = d_params.load(std::memory_order_acquire);
 
-  if (d_shift_in_radians != 0.0) {
-    volk_32fc_s32fc_multiply_32fc(out, in, d_shift_cc, noutput_items);
-  } else {
-    memcpy(out, in, sizeof(gr_complex) * noutput_items);
+  if (params != d_lastParams) {
+    unpackParams(params, d_shift_in_radians, d_ramp);
+    d_lastParams = params;
+  }
+
+  // Phase tags take effect on the tagged sample:
+  //   phase:      set the total phase (rad)
+  //   phase_step: add to the current phase (rad)
+  //   phase_ramp: change the ramp rate (rad/sample)
+  std::vector<gr::tag_t> tags;
+  uint64_t readStart = nitems_read(0);
+  get_tags_in_range(tags, 0, readStart, readStart + noutput_items);
+
+  int curItem = 0;
+
+  for (size_t i = 0; i < tags.size(); i++) {
+    bool isPhase = pmt::eqv(tags[i].key, phaseKey);
+    bool isStep = pmt::eqv(tags[i].key, phaseStepKey);
+    bool isRamp = pmt::eqv(tags[i].key, phaseRampKey);
+
+    if ((!isPhase && !isStep && !isRamp) || !pmt::is_number(tags[i].value))
+      continue;
+
+    int tagItem = tags[i].offset - readStart;
+
+    rotate(&in[curItem], &out[curItem], tagItem - curItem);
+    curItem = tagItem;
+
+    double value = pmt::to_double(tags[i].value);
+
+    if (isPhase)
+      d_phaseAccum = value - (double)d_shift_in_radians;
+    else if (isStep)
+      d_phaseAccum = fmod(d_phaseAccum + value, 2.0 * M_PI);
+    else {
+      d_ramp = value;
+      storeTagRamp(d_ramp);
+    }
   }
 
+  rotate(&in[curItem], &out[curItem], noutput_items - curItem);
+
   // Tell runtime system how many output items we produced.
   return noutput_items;
 }
@@ -21,6 +21,7 @@
 #ifndef INCLUDED_MESA_PHASE_SHIFT_IMPL_H
 #define INCLUDED_MESA_PHASE_SHIFT_IMPL_H
 
+#include <atomic>
 #include <mesa/phase_shift.h>
 
 namespace gr {
@@ -28,17 +29,41 @@ namespace mesa {
 
 class phase_shift_impl : public phase_shift {
 private:
+  // The shift and ramp are set from other threads.  They're packed together
+  // into one atomic word so work() always picks up a consistent pair
+  // without taking a lock.
+  std::atomic<uint64_t> d_params;
+  uint64_t d_lastParams;
+
+  // Working copies used by work()
   float d_shift_in_radians;
-  gr_complex d_shift_cc;
+  float d_ramp;
+
+  // Phase added by the ramp and any tagged steps.  Kept in double and
+  // wrapped so long runs don't lose precision.
+  double d_phaseAccum;
+
+  pmt::pmt_t phaseKey;
+  pmt::pmt_t phaseStepKey;
+  pmt::pmt_t phaseRampKey;
+
+  static uint64_t packParams(float shift, float ramp);
+  static void unpackParams(uint64_t packed, float &shift, float &ramp);
+
+  void rotate(const gr_complex *in, gr_complex *out, int numItems);
+  void storeTagRamp(float newRamp);
 
 public:
-  phase_shift_impl(float shift_in_radians);
+  phase_shift_impl(float shift_in_radians, float ramp_rad_per_sample);
   ~phase_shift_impl();
 
   virtual float get_shift() const;
   virtual void set_shift(float newValue);
+  virtual float get_ramp() const;
+  virtual void set_ramp(float newValue);
 
   void handle_msg_in(pmt::pmt_t msg);
+  void handle_ramp_msg_in(pmt::pmt_t msg);
 
   // Where all the action really happens
   int work(int noutput_items, gr_vector_const_void_star &input_items,
@@ -0,0 +1,158 @@
+/*
+ * ringbuffer_mesa.h
+ *
+ *      Copyright 2019, Michael Piscopo
+ *
+ */
+
+#ifndef LIB_RINGBUFFER_MESA_H_
+#define LIB_RINGBUFFER_MESA_H_
+
+#include "scomplex.h"
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <volk/volk.h>
+
+namespace MesaSignals {
+
+/*
+ * Lock-free single-producer / single-consumer ring buffer of complex samples.
+ *
+ * One thread (e.g. a message handler) may call enqueue() while another thread
+ * (e.g. work()) calls dequeue().  No locks are taken; the read and write
+ * positions are free-running counters published with acquire/release
+ * semantics. Data moves in bulk with at most two memcpy's per call (one if
+ * the block doesn't wrap the end of the buffer).
+ *
+ * The capacity is rounded up to the next power of 2 so wrapping is a mask.
+ */
+class ComplexRingBuffer {
+public:
+  ComplexRingBuffer(long minCapacity) {
+    if (minCapacity <= 0)
+      throw std::out_of_range("[ComplexRingBuffer] capacity must be > 0");
+
+    d_capacity = 1;
+    while (d_capacity < minCapacity)
+      d_capacity <<= 1;
+
+    d_mask = d_capacity - 1;
+
+    size_t memAlignment = volk_get_alignment();
+    buffer = (SComplex *)volk_malloc(d_capacity * sizeof(SComplex),
+                                     memAlignment);
+
+    if (!buffer)
+      throw std::runtime_error(
+          "[ComplexRingBuffer] buffer allocation failed");
+
+    writeCount.store(0);
+    readCount.store(0);
+  };
+
+  virtual ~ComplexRingBuffer() {
+    if (buffer) {
+      volk_free(buffer);
+      buffer = NULL;
+    }
+  };
+
+  ComplexRingBuffer(const ComplexRingBuffer &) = delete;
+  ComplexRingBuffer &operator=(const ComplexRingBuffer &) = delete;
+
+  inline long capacity() const { return d_capacity; };
+
+  // Number of samples currently queued.  Safe to call from either side.
+  inline long size() const {
+    return (long)(writeCount.load(std::memory_order_acquire) -
+                  readCount.load(std::memory_order_acquire));
+  };
+
+  // Free space available to the producer.
+  inline long space() const { return d_capacity - size(); };
+
+  // Producer side.  Copies up to numItems samples in and returns the number
+  // actually queued (less than numItems if the ring is full).
+  inline long enqueue(const SComplex *data, long numItems) {
+    unsigned long w = writeCount.load(std::memory_order_relaxed);
+    unsigned long r = readCount.load(std::memory_order_acquire);
+
+    long freeSpace = d_capacity - (long)(w - r);
+
+    if (numItems > freeSpace)
+      numItems = freeSpace;
+
+    if (numItems <= 0)
+      return 0;
+
+    long startIndex = (long)(w & d_mask);
+    long firstChunk = d_capacity - startIndex;
+
+    if (firstChunk > numItems)
+      firstChunk = numItems;
+
+    memcpy(&buffer[startIndex], data, firstChunk * sizeof(SComplex));
+
+    if (firstChunk < numItems)
+      memcpy(&buffer[0], &data[firstChunk],
+             (numItems - firstChunk) * sizeof(SComplex));
+
+    writeCount.store(w + numItems, std::memory_order_release);
+
+    return numItems;
+  };
+
+  // Consumer side.  Copies up to numItems samples out and returns the number
+  // actually dequeued.
+  inline long dequeue(SComplex *data, long numItems) {
+    unsigned long r = readCount.load(std::memory_order_relaxed);
+    unsigned long w = writeCount.load(std::memory_order_acquire);
+
+    long queued = (long)(w - r);
+
+    if (numItems > queued)
+      numItems = queued;
+
+    if (numItems <= 0)
+      return 0;
+
+    long startIndex = (long)(r & d_mask);
+    long firstChunk = d_capacity - startIndex;
+
+    if (firstChunk > numItems)
+      firstChunk = numItems;
+
+    memcpy(data, &buffer[startIndex], firstChunk * sizeof(SComplex));
+
+    if (firstChunk < numItems)
+      memcpy(&data[firstChunk], &buffer[0],
+             (numItems - firstChunk) * sizeof(SComplex));
+
+    readCount.store(r + numItems, std::memory_order_release);
+
+    return numItems;
+  };
+
+  // Consumer side.  Drops everything currently queued.
+  inline void clear() {
+    readCount.store(writeCount.load(std::memory_order_acquire),
+                    std::memory_order_release);
+  };
+
+protected:
+  SComplex *buffer;
+  long d_capacity;
+  unsigned long d_mask;
+
+  // Pad the producer and consumer counters onto separate cache lines so the
+  // two threads aren't fighting over the same line.
+  char padding1[64];
+  std::atomic<unsigned long> writeCount;
+  char padding2[64];
+  std::atomic<unsigned long> readCount;
+};
+
+} // namespace MesaSignals
+
+#endif /* LIB_RINGBUFFER_MESA_H_ */
@@ -19,6 +19,11 @@ namespace MesaSignals {
 
 static int fftInstanceCount = 0;
 
+// FFTW's planner (and plan destruction and wisdom) aren't thread-safe.  Plans
+// can be made from setters while other blocks are running, so everything
+// that touches the planner goes through this.
+static boost::mutex fftPlannerMutex;
+
 void printArray(FloatVector &arr, string name) {
   int arrSize = arr.size();
 
@@ -49,7 +54,78 @@ void printArray(float *arr, int arrSize, string name) {
   }
 }
 
+void convertToComplex(const void *in, int sampleFormat, long numSamples,
+                      SComplex *out) {
+  // volk's converters divide by the scalar
+  float divisor = 1.0f / sampleFormatScale(sampleFormat);
+
+  switch (sampleFormat) {
+  case SAMPLE_FORMAT_SC16:
+    volk_16i_s32f_convert_32f((float *)out, (const int16_t *)in, divisor,
+                              2 * numSamples);
+    break;
+  case SAMPLE_FORMAT_SC8:
+    volk_8i_s32f_convert_32f((float *)out, (const int8_t *)in, divisor,
+                             2 * numSamples);
+    break;
+  default:
+    memcpy(out, in, numSamples * sizeof(SComplex));
+    break;
+  }
+}
+
+// Converts, scales, and windows interleaved integer I/Q into an FFT input
+// buffer in one pass.  Kept simple so the compiler can vectorize it.
+template <class T>
+static inline void loadInterleaved(SComplex *dest, const T *iq,
+                                   const float *taps, float scale, int n) {
+  float *out = (float *)dest;
+
+  if (taps) {
+    for (int k = 0; k < n; k++) {
+      float w = taps[k] * scale;
+      out[2 * k] = (float)iq[2 * k] * w;
+      out[2 * k + 1] = (float)iq[2 * k + 1] * w;
+    }
+  } else {
+    for (int k = 0; k < 2 * n; k++)
+      out[k] = (float)iq[k] * scale;
+  }
+}
+
 // ------------------   FFT   ---------------------------------------
+FFTContext::FFTContext(int initFFTSize) {
+  fftSize = initFFTSize;
+
+  // Aligned memory has better performance.  It also has to have the same
+  // alignment as the buffers the plan was made with for fftwf_execute_dft.
+  size_t memAlignment = volk_get_alignment();
+  inputBuffer =
+      (SComplex *)volk_malloc(fftSize * sizeof(SComplex), memAlignment);
+  outputBuffer =
+      (SComplex *)volk_malloc(fftSize * sizeof(SComplex), memAlignment);
+  tmpBuff = (float *)volk_malloc(fftSize * sizeof(float), memAlignment);
+
+  if (!inputBuffer || !outputBuffer || !tmpBuff) {
+    if (inputBuffer)
+      volk_free(inputBuffer);
+
+    if (outputBuffer)
+      volk_free(outputBuffer);
+
+    if (tmpBuff)
+      volk_free(tmpBuff);
+
+    throw std::runtime_error("[FFTContext] buffer allocation failed");
+  }
+}
+
+FFTContext::~FFTContext() {
+  volk_free(inputBuffer);
+  volk_free(outputBuffer);
+  volk_free(tmpBuff);
+}
+
 FFT::FFT(int FFTDirection, int initFFTSize, int initNumThreads)
     : fftDirection(FFTDirection), fftSize(initFFTSize),
       numThreads(initNumThreads) {
@@ -66,26 +142,19 @@ void FFT::init() {
   halfFFTSizeBytes = fftLenBytes / 2;
   halfFFTSize = fftSize / 2;
 
+  windowTaps.store(NULL);
+
+  boost::mutex::scoped_lock plannerLock(fftPlannerMutex);
+
   initThreads();
   importWisdom();
 
   // Requires FFT Size which is set in the constructor
-  /*
-  inputBuffer = new SComplex[inputBufferLength()];
-  outputBuffer = new SComplex[outputBufferLength()];
-  */
-  // Aligned memory has better performance:
-  size_t memAlignment = volk_get_alignment();
-  inputBuffer = (SComplex *)volk_malloc(inputBufferLength() * sizeof(SComplex),
-                                        memAlignment);
-  outputBuffer = (SComplex *)volk_malloc(
-      outputBufferLength() * sizeof(SComplex), memAlignment);
-  tmpBuff =
-      (float *)volk_malloc(outputBufferLength() * sizeof(float), memAlignment);
-
-  alignedWindowTaps =
-      (float *)volk_malloc(fftSize * sizeof(float), memAlignment);
-  hasTaps = false;
+  // The plan is made against the default context's buffers.  Other contexts
+  // are allocated the same way so the plan can be run on any of them.
+  defaultContext = new FFTContext(fftSize);
+  inputBuffer = defaultContext->inputBuffer;
+  outputBuffer = defaultContext->outputBuffer;
 
   // fftDirection is set in the constructor
 
@@ -93,20 +162,6 @@ void FFT::init() {
   // Make sure the sizes are the same (they should be)
   assert(sizeof(fftwf_complex) == sizeof(SComplex));
 
-  if (!inputBuffer)
-    throw std::runtime_error("[FFT] input buffer allocation failed");
-
-  if (!outputBuffer) {
-    volk_free(inputBuffer);
-    throw std::runtime_error("[FFT] output buffer allocation failed");
-  }
-
-  if (!tmpBuff) {
-    volk_free(inputBuffer);
-    volk_free(outputBuffer);
-    throw std::runtime_error("[FFT] tmp buffer allocation failed");
-  }
-
   fftPlan = fftwf_plan_dft_1d(
       fftSize, reinterpret_cast<fftwf_complex *>(inputBuffer),
       reinterpret_cast<fftwf_complex *>(outputBuffer),
@@ -127,26 +182,42 @@ void FFT::initThreads() {
   fftwf_plan_with_nthreads(numThreads);
 }
 
+void FFT::publishWindow(const float *taps) {
+  // Called with d_mutex held
+  if (!taps) {
+    windowTaps.store(NULL, std::memory_order_release);
+    return;
+  }
+
+  size_t memAlignment = volk_get_alignment();
+  float *newTaps = (float *)volk_malloc(fftSize * sizeof(float), memAlignment);
+
+  if (!newTaps)
+    throw std::runtime_error("[FFT] window allocation failed");
+
+  memcpy(newTaps, taps, fftSize * sizeof(float));
+  windowBuffers.push_back(newTaps);
+
+  windowTaps.store(newTaps, std::memory_order_release);
+}
+
 void FFT::setWindow(int winType) {
   boost::mutex::scoped_lock scoped_lock(d_mutex);
 
-  FloatVector windowTaps;
-  size_t memAlignment = volk_get_alignment();
+  FloatVector taps;
 
   switch (winType) {
   case WINDOWTYPE_NONE:
-    hasTaps = false;
+    publishWindow(NULL);
     break;
   case WINDOWTYPE_HAMMING:
-    windowTaps = gr::fft::window::hamming(fftSize);
-    memcpy(alignedWindowTaps, &windowTaps[0], fftSize * sizeof(float));
-    hasTaps = true;
+    taps = gr::fft::window::hamming(fftSize);
+    publishWindow(&taps[0]);
     break;
 
   case WINDOWTYPE_BLACKMAN_HARRIS:
-    windowTaps = gr::fft::window::blackman_harris(fftSize);
-    memcpy(alignedWindowTaps, &windowTaps[0], fftSize * sizeof(float));
-    hasTaps = true;
+    taps = gr::fft::window::blackman_harris(fftSize);
+    publishWindow(&taps[0]);
     break;
 
   default:
@@ -158,20 +229,17 @@ void FFT::setWindow(FloatVector &newTaps) {
   boost::mutex::scoped_lock scoped_lock(d_mutex);
 
   if (newTaps.size() > 0) {
-    hasTaps = true;
-
     if (newTaps.size() != fftSize)
       throw std::out_of_range("[FFT]: setWindow(newTaps) tap size " +
                               to_string(newTaps.size()) + " != fft size " +
                               to_string(fftSize));
 
-    memcpy(alignedWindowTaps, &newTaps[0], fftSize * sizeof(float));
-
+    publishWindow(&newTaps[0]);
   } else
-    hasTaps = false;
+    publishWindow(NULL);
 }
 
-void FFT::clearWindow() { hasTaps = false; }
+void FFT::clearWindow() { windowTaps.store(NULL, std::memory_order_release); }
 
 void FFT::importWisdom() {
   wisdomFilename = ".fftw_wisdom";
@@ -201,55 +269,78 @@ void FFT::exportWisdom() {
 }
 
 inline void FFT::execute(bool shift) {
-  boost::mutex::scoped_lock scoped_lock(d_mutex);
-
-  if (hasTaps) {
-    // Apply window function first
-    volk_32fc_32f_multiply_32fc(inputBuffer, inputBuffer, alignedWindowTaps,
-                                fftSize);
-  }
+  execute(*defaultContext, windowTaps.load(std::memory_order_acquire), shift);
+}
 
-  fftwf_execute((fftwf_plan)fftPlan);
+inline void FFT::execute(float *pTaps, bool shift) {
+  execute(*defaultContext, pTaps, shift);
+}
 
-  if (shift) {
-    // DC center is at out[0] so need to swap halves first.
-    // Move top half to tmp buffer
-    memcpy(tmpBuff, &outputBuffer[halfFFTSize], halfFFTSizeBytes);
-    // move lower half up
-    memcpy(&outputBuffer[halfFFTSize], &outputBuffer[0], halfFFTSizeBytes);
-    // put top half back in the lower half
-    memcpy(&outputBuffer[0], &tmpBuff[0], halfFFTSizeBytes);
-  }
+void FFT::execute(FFTContext &context, bool shift) {
+  execute(context, windowTaps.load(std::memory_order_acquire), shift);
 }
 
-inline void FFT::execute(float *pTaps, bool shift) {
-  boost::mutex::scoped_lock scoped_lock(d_mutex);
+void FFT::execute(FFTContext &context, float *pTaps, bool shift) {
+  SComplex *in = context.inputBuffer;
+  SComplex *out = context.outputBuffer;
 
   if (pTaps) {
     // Apply window function first
-    volk_32fc_32f_multiply_32fc(inputBuffer, inputBuffer, pTaps, fftSize);
+    volk_32fc_32f_multiply_32fc(in, in, pTaps, fftSize);
   }
 
-  fftwf_execute((fftwf_plan)fftPlan);
+  // The new-array execute is the thread-safe way to run one plan on
+  // different buffers.
+  fftwf_execute_dft((fftwf_plan)fftPlan, reinterpret_cast<fftwf_complex *>(in),
+                    reinterpret_cast<fftwf_complex *>(out));
 
   if (shift) {
+    float *tmpBuff = context.tmpBuff;
     // DC center is at out[0] so need to swap halves first.
     // Move top half to tmp buffer
-    memcpy(tmpBuff, &outputBuffer[halfFFTSize], halfFFTSizeBytes);
+    memcpy(tmpBuff, &out[halfFFTSize], halfFFTSizeBytes);
     // move lower half up
-    memcpy(&outputBuffer[halfFFTSize], &outputBuffer[0], halfFFTSizeBytes);
+    memcpy(&out[halfFFTSize], &out[0], halfFFTSizeBytes);
     // put top half back in the lower half
-    memcpy(&outputBuffer[0], &tmpBuff[0], halfFFTSizeBytes);
+    memcpy(&out[0], &tmpBuff[0], halfFFTSizeBytes);
   }
 }
 
+void FFT::executeInterleaved(FFTContext &context, const int16_t *iq,
+                             float scale, bool shift) {
+  loadInterleaved(context.inputBuffer, iq,
+                  windowTaps.load(std::memory_order_acquire), scale, fftSize);
+
+  // Window's already applied
+  execute(context, NULL, shift);
+}
+
+void FFT::executeInterleaved(FFTContext &context, const int8_t *iq,
+                             float scale, bool shift) {
+  loadInterleaved(context.inputBuffer, iq,
+                  windowTaps.load(std::memory_order_acquire), scale, fftSize);
+
+  execute(context, NULL, shift);
+}
+
 inline void FFT::PowerSpectralDensity(float *psdBuffer, float squelchThreshold,
                                       float onSquelchSetRSSI) {
-  return rssi(psdBuffer, squelchThreshold, onSquelchSetRSSI);
+  return rssi(*defaultContext, psdBuffer, squelchThreshold, onSquelchSetRSSI);
+}
+
+void FFT::PowerSpectralDensity(FFTContext &context, float *psdBuffer,
+                               float squelchThreshold,
+                               float onSquelchSetRSSI) {
+  return rssi(context, psdBuffer, squelchThreshold, onSquelchSetRSSI);
 }
 
 void FFT::rssi(float *psdBuffer, float squelchThreshold,
                float onSquelchSetRSSI) {
+  rssi(*defaultContext, psdBuffer, squelchThreshold, onSquelchSetRSSI);
+}
+
+void FFT::rssi(FFTContext &context, float *psdBuffer, float squelchThreshold,
+               float onSquelchSetRSSI) {
   // Note: using aligned memory can be notably faster than the unaligned
   // versions Calcs were slightly different using the 3-call approach.  Not sure
   // why. The math looks the same.
@@ -268,9 +359,10 @@ void FFT::rssi(float *psdBuffer, float squelchThreshold,
   // Store results in place
   volk_32f_s32f_multiply_32f(psdBuffer,psdBuffer,log2To10Factor,fftSize);
   */
+  float *tmpBuff = context.tmpBuff;
 
-  volk_32fc_s32f_x2_power_spectral_density_32f(psdBuffer, outputBuffer, fftSize,
-                                               1.0, fftSize);
+  volk_32fc_s32f_x2_power_spectral_density_32f(
+      psdBuffer, context.outputBuffer, fftSize, 1.0, fftSize);
 
   // DC center is at out[0] so need to swap halves first.
   // Move top half to tmp buffer
@@ -288,22 +380,28 @@ void FFT::rssi(float *psdBuffer, float squelchThreshold,
   }
 }
 
+void FFT::MagnitudeSquared(float *magBuffer) {
+  MagnitudeSquared(*defaultContext, magBuffer);
+}
+
+void FFT::MagnitudeSquared(FFTContext &context, float *magBuffer) {
+  volk_32fc_magnitude_squared_32f(magBuffer, context.outputBuffer, fftSize);
+}
+
 FFT::~FFT() {
+  boost::mutex::scoped_lock plannerLock(fftPlannerMutex);
+
   fftwf_destroy_plan((fftwf_plan)fftPlan);
 
-  /*
-      delete[] inputBuffer;
-      delete[] outputBuffer;
-      */
-  volk_free(inputBuffer);
-  volk_free(outputBuffer);
-  volk_free(tmpBuff);
+  delete defaultContext;
 
-  if (alignedWindowTaps) {
-    // In any case we need to clear what we had.
-    volk_free(alignedWindowTaps);
-    alignedWindowTaps = NULL;
-  }
+  // In any case we need to clear what we had.
+  windowTaps.store(NULL);
+
+  for (size_t i = 0; i < windowBuffers.size(); i++)
+    volk_free(windowBuffers[i]);
+
+  windowBuffers.clear();
 
   fftInstanceCount--;
 
@@ -327,9 +425,98 @@ SpectrumOverview &SpectrumOverview::operator=(const SpectrumOverview &other) {
   return *this;
 }
 
+void SpectrumOverviewBatch::resize(long newNumRows) {
+  if ((long)dutyCycle.size() < newNumRows) {
+    dutyCycle.resize(newNumRows);
+    maxPower.resize(newNumRows);
+    minPower.resize(newNumRows);
+    centerAvgPower.resize(newNumRows);
+    avgPower.resize(newNumRows);
+    minPowerOverThreshold.resize(newNumRows);
+  }
+
+  numRows = newNumRows;
+}
+
+void SpectrumOverviewBatch::getOverview(long i,
+                                        SpectrumOverview &overview) const {
+  overview.dutyCycle = dutyCycle[i];
+  overview.maxPower = maxPower[i];
+  overview.minPower = minPower[i];
+  overview.centerAvgPower = centerAvgPower[i];
+  overview.avgPower = avgPower[i];
+  overview.minPowerOverThreshold = minPowerOverThreshold[i];
+}
+
 // -----------------  End SpectrumOverview
 // ---------------------------------------
 
+/*
+ * Computes the count of bins >= threshold, min, max, and sum of a spectrum
+ * row in one pass.  Each statistic is spread across SPECTRUM_STATS_LANES
+ * accumulators with no branches in the loop (the compares compile to
+ * min/max/mask instructions) so it vectorizes, then the lanes are combined
+ * at the end.  min starts at 1000.0 and max at NOISE_FLOOR to match the
+ * original scalar loops.
+ */
+static void spectrumRowStats(const float *row, int rowLen, float threshold,
+                             int &count, float &minValue, float &maxValue,
+                             float &sum) {
+  int laneCount[SPECTRUM_STATS_LANES];
+  float laneMin[SPECTRUM_STATS_LANES];
+  float laneMax[SPECTRUM_STATS_LANES];
+  float laneSum[SPECTRUM_STATS_LANES];
+  int k;
+
+  for (k = 0; k < SPECTRUM_STATS_LANES; k++) {
+    laneCount[k] = 0;
+    laneMin[k] = 1000.0;
+    laneMax[k] = NOISE_FLOOR;
+    laneSum[k] = 0.0;
+  }
+
+  int vecLen = rowLen - (rowLen % SPECTRUM_STATS_LANES);
+  int j;
+
+  for (j = 0; j < vecLen; j += SPECTRUM_STATS_LANES) {
+    for (k = 0; k < SPECTRUM_STATS_LANES; k++) {
+      float value = row[j + k];
+
+      laneCount[k] += (value >= threshold);
+      laneMin[k] = (value < laneMin[k]) ? value : laneMin[k];
+      laneMax[k] = (value > laneMax[k]) ? value : laneMax[k];
+      laneSum[k] += value;
+    }
+  }
+
+  // Tail
+  for (; j < rowLen; j++) {
+    float value = row[j];
+
+    laneCount[0] += (value >= threshold);
+    laneMin[0] = (value < laneMin[0]) ? value : laneMin[0];
+    laneMax[0] = (value > laneMax[0]) ? value : laneMax[0];
+    laneSum[0] += value;
+  }
+
+  count = laneCount[0];
+  minValue = laneMin[0];
+  maxValue = laneMax[0];
+  sum = laneSum[0];
+
+  for (k = 1; k < SPECTRUM_STATS_LANES; k++) {
+    count += laneCount[k];
+
+    if (laneMin[k] < minValue)
+      minValue = laneMin[k];
+
+    if (laneMax[k] > maxValue)
+      maxValue = laneMax[k];
+
+    sum += laneSum[k];
+  }
+}
+
 // -----------------  Start Waterfall Data
 // ---------------------------------------
 WaterfallData::WaterfallData() {
@@ -398,292 +585,783 @@ void SignalOverview::print() {
 
 // -----------------  End SignalOverview ---------------------------------------
 
-// -----------------  Start Energy Analyzer
+// -----------------  Start SharedSpectrum
 // ---------------------------------------
-EnergyAnalyzer::EnergyAnalyzer(int initFFTSize, float initSquelchThreshold,
-                               float initMinDutyCycle, bool useWindow) {
+SharedSpectrum::SharedSpectrum(int initFFTSize, int initNumFrames) {
   fftSize = initFFTSize;
-  centerBucket = fftSize / 2;
-
-  squelchThreshold = initSquelchThreshold;
-  minDutyCycle = initMinDutyCycle;
+  numFrames = initNumFrames;
 
-  fftProc = new FFT(FFTDIRECTION_FORWARD, fftSize);
-
-  if (useWindow)
-    fftProc->setWindow(WINDOWTYPE_BLACKMAN_HARRIS);
+  if (numFrames < 1)
+    numFrames = 1;
 
   size_t memAlignment = volk_get_alignment();
-  psdSpectrum = (float *)volk_malloc(fftSize * sizeof(float), memAlignment);
-}
+  spectra = (float *)volk_malloc(numFrames * fftSize * sizeof(float),
+                                 memAlignment);
 
-EnergyAnalyzer::~EnergyAnalyzer() {
-  delete fftProc;
+  slotFrame.resize(numFrames, 0);
+  slotValid.resize(numFrames, false);
 
-  volk_free(psdSpectrum);
+  framesComputed = 0;
+  framesShared = 0;
 }
 
-long EnergyAnalyzer::analyze(const SComplex *frame, long numSamples,
-                             SpectrumOverviewVector &results) {
-  long numBlocks = numSamples / fftSize;
+SharedSpectrum::~SharedSpectrum() {
+  volk_free(spectra);
+}
 
-  if (numBlocks <= 0 || (frame == NULL))
-    return 0;
+std::shared_ptr<SharedSpectrum>
+SharedSpectrum::getInstance(const std::string &name, int fftSize,
+                            int windowType) {
+  // Registry of live instances.  Only weak references are held so the
+  // instance goes away with the last analyzer using it.
+  static boost::mutex registryMutex;
+  static std::map<std::string, std::weak_ptr<SharedSpectrum>> registry;
 
-  SComplex *fftInput;
-  long index;
+  std::string key = name + ":" + std::to_string(fftSize) + ":" +
+                    std::to_string(windowType);
 
-  results.clear();
-  // Allocate the memory all at one time.
-  results.reserve(numBlocks);
+  boost::mutex::scoped_lock guard(registryMutex);
 
-  for (long i = 0; i < numBlocks; i++) {
-    // Calculate the FFT for the current block
-    index = i * fftSize;
-    fftInput = fftProc->getInputBuffer();
-    memcpy(fftInput, &frame[index], fftSize * sizeof(SComplex));
-    fftProc->execute();
+  std::shared_ptr<SharedSpectrum> instance = registry[key].lock();
 
-    // Get the PSD of the result with a squelch threshold
-    fftProc->PowerSpectralDensity(psdSpectrum, squelchThreshold);
+  if (!instance) {
+    instance = std::make_shared<SharedSpectrum>(fftSize);
+    registry[key] = instance;
+  }
 
-    // Now analyze the spectrum
-    int bucketswithPower = 0;
-    float maxPower = NOISE_FLOOR;
-    float totalPower = 0.0;
-    float minPower = 1000.0;
+  return instance;
+}
 
-    for (int j = 0; j < fftSize; j++) {
-      if (psdSpectrum[j] >= squelchThreshold) {
-        bucketswithPower++;
-      }
+bool SharedSpectrum::lookupPSD(uint64_t frameIndex, float *psdBuffer) {
+  int slot = (int)(frameIndex % (uint64_t)numFrames);
 
-      if (psdSpectrum[j] < minPower) {
-        minPower = psdSpectrum[j];
-      }
+  boost::mutex::scoped_lock guard(d_mutex);
 
-      totalPower += psdSpectrum[j];
+  if (!slotValid[slot] || (slotFrame[slot] != frameIndex))
+    return false;
 
-      if (psdSpectrum[j] > maxPower)
-        maxPower = psdSpectrum[j];
-    }
+  memcpy(psdBuffer, &spectra[slot * fftSize], fftSize * sizeof(float));
+  framesShared++;
 
-    if (minPower == 1000.0)
-      minPower = NOISE_FLOOR;
+  return true;
+}
 
-    float curDutyCycle = (float)bucketswithPower / (float)fftSize;
+void SharedSpectrum::storePSD(uint64_t frameIndex, const float *psdBuffer) {
+  int slot = (int)(frameIndex % (uint64_t)numFrames);
 
-    SpectrumOverview spectrumOverview;
-    spectrumOverview.dutyCycle = curDutyCycle;
-    spectrumOverview.maxPower = maxPower;
-    spectrumOverview.minPower = minPower;
-    spectrumOverview.centerAvgPower =
-        (psdSpectrum[centerBucket] + psdSpectrum[centerBucket + 1]) / 2.0;
-    spectrumOverview.avgPower = totalPower / (float)fftSize;
-    spectrumOverview.minPowerOverThreshold = minPower;
+  boost::mutex::scoped_lock guard(d_mutex);
 
-    results.push_back(spectrumOverview);
+  // Don't replace a newer frame that landed in the slot in the meantime
+  if (!slotValid[slot] || (slotFrame[slot] < frameIndex)) {
+    memcpy(&spectra[slot * fftSize], psdBuffer, fftSize * sizeof(float));
+    slotFrame[slot] = frameIndex;
+    slotValid[slot] = true;
   }
 
-  return (numBlocks * fftSize);
+  framesComputed++;
 }
 
-void EnergyAnalyzer::analyzeSpectrum(const float *spectrum, float &dutyCycle,
-                                     float &maxPower, float &minPower,
-                                     float &centerAvgPower, float &avgPower) {
-  int bucketswithPower = 0;
-  maxPower = NOISE_FLOOR;
-  float totalPower = 0.0;
-  minPower = 1000.0;
+// -----------------  End SharedSpectrum
+// ---------------------------------------
 
-  for (int j = 0; j < fftSize; j++) {
-    if (spectrum[j] >= squelchThreshold) {
-      bucketswithPower++;
-    }
+// -----------------  Start WorkerPool
+// ---------------------------------------
+WorkerPool::WorkerPool(int initNumWorkers) {
+  numWorkers = initNumWorkers;
+
+  if (numWorkers < 1)
+    numWorkers = 1;
+
+  curJob = NULL;
+  totalJobs = 0;
+  nextJob.store(0);
+  busyWorkers = 0;
+  generation = 0;
+  shuttingDown = false;
+
+  // Worker 0 is whoever calls run()
+  for (int i = 1; i < numWorkers; i++)
+    threads.push_back(new boost::thread(&WorkerPool::workerLoop, this, i));
+}
 
-    if (spectrum[j] < minPower)
-      minPower = spectrum[j];
+WorkerPool::~WorkerPool() {
+  {
+    boost::mutex::scoped_lock guard(d_mutex);
+    shuttingDown = true;
+  }
 
-    totalPower += spectrum[j];
+  workReady.notify_all();
 
-    if (spectrum[j] > maxPower)
-      maxPower = spectrum[j];
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i]->join();
+    delete threads[i];
   }
 
-  dutyCycle = (float)bucketswithPower / (float)fftSize;
+  threads.clear();
+}
 
-  centerAvgPower = (spectrum[centerBucket] + spectrum[centerBucket + 1]) / 2.0;
+void WorkerPool::runJobs(int worker) {
+  long job;
 
-  avgPower = totalPower / (float)fftSize;
+  while ((job = nextJob.fetch_add(1)) < totalJobs)
+    (*curJob)(worker, job);
 }
 
-long EnergyAnalyzer::getWaterfall(const SComplex *frame, long numSamples,
-                                  WaterfallData &waterfallData) {
-  long numBlocks = numSamples / fftSize;
+void WorkerPool::workerLoop(int worker) {
+  uint64_t lastGeneration = 0;
 
-  if (numBlocks <= 0 || (frame == NULL))
-    return 0;
+  while (true) {
+    {
+      boost::mutex::scoped_lock guard(d_mutex);
 
-  SComplex *fftInput;
-  long index;
+      while (!shuttingDown && (generation == lastGeneration))
+        workReady.wait(guard);
 
-  for (long i = 0; i < numBlocks; i++) {
-    // Calculate the FFT for the current block
-    index = i * fftSize;
-    fftInput = fftProc->getInputBuffer();
-    memcpy(fftInput, &frame[index], fftSize * sizeof(SComplex));
-    fftProc->execute();
+      if (shuttingDown)
+        return;
+
+      lastGeneration = generation;
+    }
 
-    // Get the PSD of the result with a squelch threshold
-    fftProc->PowerSpectralDensity(psdSpectrum, squelchThreshold);
+    runJobs(worker);
 
-    memcpy(&waterfallData.data[index], psdSpectrum, fftSize * sizeof(float));
-  }
+    boost::mutex::scoped_lock guard(d_mutex);
 
-  return (numBlocks * fftSize);
+    busyWorkers--;
+
+    if (busyWorkers == 0)
+      workDone.notify_all();
+  }
 }
 
-long EnergyAnalyzer::powerBinarySlicer(const SComplex *frame, long numSamples,
-                                       FloatVector &bits, float &rssi) {
-  long numBlocks = numSamples / fftSize;
+void WorkerPool::run(long numJobs, const JobFunction &job) {
+  if (numJobs <= 0)
+    return;
 
-  rssi = NOISE_FLOOR;
+  if (threads.empty() || (numJobs == 1)) {
+    // Not worth waking anyone up
+    for (long j = 0; j < numJobs; j++)
+      job(0, j);
 
-  if (numBlocks <= 0 || (frame == NULL))
-    return 0;
+    return;
+  }
 
-  SComplex *fftInput;
-  long index;
+  {
+    boost::mutex::scoped_lock guard(d_mutex);
 
-  if (bits.size() != numBlocks) {
-    bits.resize(numBlocks);
+    curJob = &job;
+    totalJobs = numJobs;
+    nextJob.store(0);
+    busyWorkers = (int)threads.size();
+    generation++;
   }
 
-  float spectrumDutyCycle;
-  float *pBit;
-  float maxPower;
-  int bucketswithPower;
-  int j;
+  workReady.notify_all();
 
-  pBit = &bits[0];
+  runJobs(0);
 
-  for (long i = 0; i < numBlocks; i++) {
-    // Calculate the FFT for the current block
-    index = i * fftSize;
-    fftInput = fftProc->getInputBuffer();
-    memcpy(fftInput, &frame[index], fftSize * sizeof(SComplex));
-    fftProc->execute();
+  // Every thread has to check in before the next run can start
+  boost::mutex::scoped_lock guard(d_mutex);
 
-    // Get the PSD of the result with a squelch threshold
-    fftProc->PowerSpectralDensity(psdSpectrum, squelchThreshold);
+  while (busyWorkers > 0)
+    workDone.wait(guard);
 
-    bucketswithPower = 0;
-    maxPower = NOISE_FLOOR;
+  curJob = NULL;
+}
 
-    for (j = 0; j < fftSize; j++) {
-      if (psdSpectrum[j] >= squelchThreshold) {
-        bucketswithPower++;
+// -----------------  End WorkerPool
+// ---------------------------------------
 
-        if (psdSpectrum[j] > maxPower)
-          maxPower = psdSpectrum[j];
-      }
-    }
+// -----------------  Start Energy Analyzer
+// ---------------------------------------
+EnergyAnalyzer::EnergyAnalyzer(int initFFTSize, float initSquelchThreshold,
+                               float initMinDutyCycle, bool useWindow) {
+  fftSize = initFFTSize;
+  centerBucket = fftSize / 2;
 
-    spectrumDutyCycle = (float)bucketswithPower / (float)fftSize;
+  fftProc = new FFT(FFTDIRECTION_FORWARD, fftSize);
 
-    if (spectrumDutyCycle >= minDutyCycle) {
-      *pBit++ = 1;
+  setThreshold(initSquelchThreshold);
+  setDutyCycle(initMinDutyCycle);
 
-      if (maxPower > rssi)
-        rssi = maxPower;
-    } else {
-      *pBit++ = 0;
-    }
-  }
+  if (useWindow)
+    windowType = WINDOWTYPE_BLACKMAN_HARRIS;
+  else
+    windowType = WINDOWTYPE_NONE;
 
-  return (numBlocks * fftSize);
+  if (windowType != WINDOWTYPE_NONE)
+    fftProc->setWindow(windowType);
+
+  fftContext = fftProc->createContext();
+
+  size_t memAlignment = volk_get_alignment();
+  psdSpectrum = (float *)volk_malloc(fftSize * sizeof(float), memAlignment);
+
+  // Analyze every frame by default
+  lastFramesAnalyzed = 0;
+  firstActiveFrame = -1;
+  setFrameStride(1, 1, false);
+
+  // Parallel batch mode is off until setParallel is called
+  workerPool = NULL;
+  grainFrames = ENERGY_PARALLEL_GRAIN;
 }
 
-bool EnergyAnalyzer::energyPresent(const SComplex *frame, long numSamples,
-                                   float &rssi) {
-  long numBlocks = numSamples / fftSize;
+void EnergyAnalyzer::setFrameStride(int analyzeFrames, int everyFrames,
+                                    bool adaptive) {
+  if (analyzeFrames < 1)
+    analyzeFrames = 1;
 
-  if (numBlocks <= 0 || (frame == NULL))
-    return 0;
+  if (everyFrames < analyzeFrames)
+    everyFrames = analyzeFrames;
 
-  SComplex *fftInput;
-  long index;
-  rssi = NOISE_FLOOR;
+  framesToAnalyze = analyzeFrames;
+  frameStride = everyFrames;
+  curStride = frameStride;
+  frameCounter = 0;
+  adaptiveStride = adaptive;
+  lastMaxSpectrum.clear();
+}
 
-  for (long i = 0; i < numBlocks; i++) {
-    // Calculate the FFT for the current block
-    index = i * fftSize;
-    fftInput = fftProc->getInputBuffer();
-    memcpy(fftInput, &frame[index], fftSize * sizeof(SComplex));
-    fftProc->execute();
+void EnergyAnalyzer::setThreshold(float newThreshold) {
+  squelchThreshold = newThreshold;
+  linearThreshold = fftProc->linearPower(squelchThreshold);
+}
 
-    // Get the PSD of the result with a squelch threshold
-    fftProc->PowerSpectralDensity(psdSpectrum, squelchThreshold);
+void EnergyAnalyzer::setDutyCycle(float newDutyCycle) {
+  minDutyCycle = newDutyCycle;
 
-    // Now analyze the spectrum
-    int bucketswithPower = 0;
+  // Find the smallest bin count that satisfies
+  // (float)bins / (float)fftSize >= minDutyCycle.  If it's more than fftSize
+  // the duty cycle can never be met.
+  requiredBins = (int)ceil(minDutyCycle * (float)fftSize);
 
-    for (int j = 0; j < fftSize; j++) {
-      if (psdSpectrum[j] >= squelchThreshold) {
-        bucketswithPower++;
-      }
+  if (requiredBins < 0)
+    requiredBins = 0;
 
-      if (psdSpectrum[j] > rssi)
-        rssi = psdSpectrum[j];
-    }
+  while (requiredBins > 0 &&
+         ((float)(requiredBins - 1) / (float)fftSize) >= minDutyCycle)
+    requiredBins--;
+
+  while (requiredBins <= fftSize &&
+         ((float)requiredBins / (float)fftSize) < minDutyCycle)
+    requiredBins++;
+}
+
+void EnergyAnalyzer::computePSD(FFTContext &context, const SComplex *frame,
+                                float *psd, float squelch) {
+  memcpy(context.getInputBuffer(), frame, fftSize * sizeof(SComplex));
+  fftProc->execute(context);
+  fftProc->PowerSpectralDensity(context, psd, squelch);
+}
 
-    float curDutyCycle = (float)bucketswithPower / (float)fftSize;
+void EnergyAnalyzer::computePSD(FFTContext &context, const void *frame,
+                                int sampleFormat, float *psd, float squelch) {
+  float scale = sampleFormatScale(sampleFormat);
 
-    if (curDutyCycle >= minDutyCycle)
-      return true; // return immediately
+  switch (sampleFormat) {
+  case SAMPLE_FORMAT_SC16:
+    fftProc->executeInterleaved(context, (const int16_t *)frame, scale);
+    break;
+  case SAMPLE_FORMAT_SC8:
+    fftProc->executeInterleaved(context, (const int8_t *)frame, scale);
+    break;
+  default:
+    memcpy(context.getInputBuffer(), frame, fftSize * sizeof(SComplex));
+    fftProc->execute(context);
+    break;
   }
 
-  return false;
+  fftProc->PowerSpectralDensity(context, psd, squelch);
 }
 
-long EnergyAnalyzer::countEnergyBlocks(const SComplex *frame, long numSamples,
-                                       float &rssi) {
-  long numBlocks = numSamples / fftSize;
+int EnergyAnalyzer::countBinsOverThreshold(const SComplex *frame, int stopAt,
+                                           float &maxPower) {
+  memcpy(fftContext->getInputBuffer(), frame, fftSize * sizeof(SComplex));
+  fftProc->execute(*fftContext);
 
-  if (numBlocks <= 0 || (frame == NULL))
-    return 0;
+  // Skip the log10 and the DC swap.  Neither matters for counting.
+  fftProc->MagnitudeSquared(*fftContext, psdSpectrum);
 
-  SComplex *fftInput;
-  long index;
-  long numEnergyBlocks = 0;
-  rssi = NOISE_FLOOR;
-  float maxPower;
+  const float threshold = linearThreshold;
+  const float *pMag = psdSpectrum;
+  int binsOverThreshold = 0;
+  int i = 0;
 
-  for (long i = 0; i < numBlocks; i++) {
-    // Calculate the FFT for the current block
-    index = i * fftSize;
-    fftInput = fftProc->getInputBuffer();
-    memcpy(fftInput, &frame[index], fftSize * sizeof(SComplex));
-    fftProc->execute();
+  while (i < fftSize) {
+    int chunkEnd = i + ENERGY_COUNT_CHUNK;
 
-    // Get the PSD of the result with a squelch threshold
-    fftProc->PowerSpectralDensity(psdSpectrum, squelchThreshold);
+    if (chunkEnd > fftSize)
+      chunkEnd = fftSize;
 
-    // Now analyze the spectrum
-    int bucketswithPower = 0;
-    maxPower = NOISE_FLOOR;
+    // Keep the inner loop branch-free so the compiler can vectorize the
+    // compare and sum.
+    int chunkCount = 0;
+    for (; i < chunkEnd; i++)
+      chunkCount += (pMag[i] >= threshold);
 
-    for (int j = 0; j < fftSize; j++) {
-      if (psdSpectrum[j] >= squelchThreshold) {
-        bucketswithPower++;
+    binsOverThreshold += chunkCount;
+
+    if (binsOverThreshold >= stopAt)
+      break;
+  }
+
+  maxPower = NOISE_FLOOR;
+
+  if (binsOverThreshold > 0) {
+    uint32_t maxIndex = 0;
+    volk_32f_index_max_32u(&maxIndex, psdSpectrum, fftSize);
+    maxPower = fftProc->powerDB(psdSpectrum[maxIndex]);
+  }
+
+  return binsOverThreshold;
+}
+
+void EnergyAnalyzer::updateStride(float maxPower) {
+  int newStride;
+
+  if ((squelchThreshold == SQUELCH_DISABLE) ||
+      (maxPower >= (squelchThreshold - ENERGY_ADAPTIVE_MARGIN_DB))) {
+    // Something's there or close to it.  Look at everything.
+    newStride = framesToAnalyze;
+  } else {
+    // Quiet.  Back off.
+    newStride = curStride * 2;
+
+    if (newStride > frameStride)
+      newStride = frameStride;
+  }
+
+  if (newStride != curStride) {
+    curStride = newStride;
+    frameCounter = 0;
+  }
+}
+
+EnergyAnalyzer::~EnergyAnalyzer() {
+  clearParallel();
+
+  delete fftContext;
+  delete fftProc;
+
+  volk_free(psdSpectrum);
+}
+
+long EnergyAnalyzer::analyze(const SComplex *frame, long numSamples,
+                             SpectrumOverviewVector &results) {
+  results.clear();
+
+  long samplesProcessed = analyze(frame, numSamples, overviewBatch);
+
+  if (samplesProcessed == 0)
+    return 0;
+
+  // Allocate the memory all at one time.
+  results.resize(overviewBatch.size());
+
+  for (long i = 0; i < overviewBatch.size(); i++) {
+    overviewBatch.getOverview(i, results[i]);
+  }
+
+  return samplesProcessed;
+}
+
+long EnergyAnalyzer::analyze(const SComplex *frame, long numSamples,
+                             SpectrumOverviewBatch &results) {
+  long numBlocks = numSamples / fftSize;
+
+  results.clear();
+
+  if (numBlocks <= 0 || (frame == NULL))
+    return 0;
+
+  long index;
+
+  psdRows.reserve(fftSize, numBlocks);
+
+  for (long i = 0; i < numBlocks; i++) {
+    // Get the PSD of the current block with a squelch threshold
+    index = i * fftSize;
+    computePSD(*fftContext, &frame[index], &psdRows.data[index],
+               squelchThreshold);
+  }
+
+  // Now analyze all of the rows
+  analyzeSpectra(psdRows.data, numBlocks, results);
+
+  return (numBlocks * fftSize);
+}
+
+void EnergyAnalyzer::analyzeSpectra(const float *spectra, long numRows,
+                                    SpectrumOverviewBatch &results) {
+  results.resize(numRows);
+
+  if (numRows <= 0)
+    return;
+
+  analyzeRows(spectra, 0, numRows, results);
+}
+
+void EnergyAnalyzer::analyzeRows(const float *spectra, long firstRow,
+                                 long numRows,
+                                 SpectrumOverviewBatch &results) {
+  float *pDutyCycle = &results.dutyCycle[0];
+  float *pMaxPower = &results.maxPower[0];
+  float *pMinPower = &results.minPower[0];
+  float *pCenterAvgPower = &results.centerAvgPower[0];
+  float *pAvgPower = &results.avgPower[0];
+  float *pMinPowerOverThreshold = &results.minPowerOverThreshold[0];
+
+  int bucketswithPower;
+  float minPower;
+  float maxPower;
+  float totalPower;
+
+  long lastRow = firstRow + numRows;
+
+  for (long i = firstRow; i < lastRow; i++) {
+    const float *spectrum = &spectra[i * fftSize];
+
+    spectrumRowStats(spectrum, fftSize, squelchThreshold, bucketswithPower,
+                     minPower, maxPower, totalPower);
+
+    if (minPower == 1000.0)
+      minPower = NOISE_FLOOR;
+
+    pDutyCycle[i] = (float)bucketswithPower / (float)fftSize;
+    pMaxPower[i] = maxPower;
+    pMinPower[i] = minPower;
+    pCenterAvgPower[i] =
+        (spectrum[centerBucket] + spectrum[centerBucket + 1]) / 2.0;
+    pAvgPower[i] = totalPower / (float)fftSize;
+    pMinPowerOverThreshold[i] = minPower;
+  }
+}
+
+void EnergyAnalyzer::analyzeSpectrum(const float *spectrum, float &dutyCycle,
+                                     float &maxPower, float &minPower,
+                                     float &centerAvgPower, float &avgPower) {
+  int bucketswithPower;
+  float totalPower;
+
+  spectrumRowStats(spectrum, fftSize, squelchThreshold, bucketswithPower,
+                   minPower, maxPower, totalPower);
+
+  dutyCycle = (float)bucketswithPower / (float)fftSize;
+
+  centerAvgPower = (spectrum[centerBucket] + spectrum[centerBucket + 1]) / 2.0;
+
+  avgPower = totalPower / (float)fftSize;
+}
+
+long EnergyAnalyzer::getWaterfall(const SComplex *frame, long numSamples,
+                                  WaterfallData &waterfallData) {
+  long numBlocks = numSamples / fftSize;
+
+  if (numBlocks <= 0 || (frame == NULL))
+    return 0;
+
+  long index;
+
+  for (long i = 0; i < numBlocks; i++) {
+    // Get the PSD of the current block with a squelch threshold straight
+    // into the waterfall row
+    index = i * fftSize;
+    computePSD(*fftContext, &frame[index], &waterfallData.data[index],
+               squelchThreshold);
+  }
+
+  return (numBlocks * fftSize);
+}
+
+EnergyAnalyzer::ParallelWorker::ParallelWorker(FFT *fftProc, int fftSize) {
+  context = fftProc->createContext();
+
+  size_t memAlignment = volk_get_alignment();
+  psd = (float *)volk_malloc(fftSize * sizeof(float), memAlignment);
+
+  maxSpectrum.resize(fftSize);
+  firstActiveFrame = -1;
+}
+
+EnergyAnalyzer::ParallelWorker::~ParallelWorker() {
+  delete context;
+  volk_free(psd);
+}
+
+void EnergyAnalyzer::clearParallel() {
+  // The pool goes first so no thread is still using a worker's buffers
+  if (workerPool) {
+    delete workerPool;
+    workerPool = NULL;
+  }
+
+  for (size_t i = 0; i < parallelWorkers.size(); i++)
+    delete parallelWorkers[i];
+
+  parallelWorkers.clear();
+}
+
+void EnergyAnalyzer::setParallel(int numThreads, long grain) {
+  if (grain < 1)
+    grain = 1;
+
+  grainFrames = grain;
+
+  if (numThreads == getParallelThreads())
+    return;
+
+  clearParallel();
+
+  if (numThreads <= 1)
+    return;
+
+  for (int i = 0; i < numThreads; i++)
+    parallelWorkers.push_back(new ParallelWorker(fftProc, fftSize));
+
+  workerPool = new WorkerPool(numThreads);
+}
+
+long EnergyAnalyzer::analyzeParallel(const SComplex *frame, long numSamples,
+                                     SpectrumOverviewBatch &results) {
+  if (!workerPool)
+    return analyze(frame, numSamples, results);
+
+  long numBlocks = numSamples / fftSize;
+
+  results.clear();
+
+  if (numBlocks <= 0 || (frame == NULL))
+    return 0;
+
+  psdRows.reserve(fftSize, numBlocks);
+  results.resize(numBlocks);
+
+  long numJobs = (numBlocks + grainFrames - 1) / grainFrames;
+
+  // Each job only writes its own rows, so there's nothing to merge.
+  workerPool->run(numJobs, [&](int worker, long job) {
+    FFTContext &context = *parallelWorkers[worker]->context;
+    long firstRow = job * grainFrames;
+    long lastRow = firstRow + grainFrames;
+
+    if (lastRow > numBlocks)
+      lastRow = numBlocks;
+
+    for (long i = firstRow; i < lastRow; i++) {
+      long index = i * fftSize;
+      computePSD(context, &frame[index], &psdRows.data[index],
+                 squelchThreshold);
+    }
+
+    // The rows are still in cache
+    analyzeRows(psdRows.data, firstRow, lastRow - firstRow, results);
+  });
+
+  return (numBlocks * fftSize);
+}
+
+long EnergyAnalyzer::getWaterfallParallel(const SComplex *frame,
+                                          long numSamples,
+                                          WaterfallData &waterfallData) {
+  if (!workerPool)
+    return getWaterfall(frame, numSamples, waterfallData);
+
+  long numBlocks = numSamples / fftSize;
+
+  if (numBlocks <= 0 || (frame == NULL))
+    return 0;
+
+  long numJobs = (numBlocks + grainFrames - 1) / grainFrames;
+
+  workerPool->run(numJobs, [&](int worker, long job) {
+    FFTContext &context = *parallelWorkers[worker]->context;
+    long firstRow = job * grainFrames;
+    long lastRow = firstRow + grainFrames;
+
+    if (lastRow > numBlocks)
+      lastRow = numBlocks;
+
+    for (long i = firstRow; i < lastRow; i++) {
+      long index = i * fftSize;
+      computePSD(context, &frame[index], &waterfallData.data[index],
+                 squelchThreshold);
+    }
+  });
+
+  return (numBlocks * fftSize);
+}
+
+long EnergyAnalyzer::maxHoldParallel(const SComplex *frame, long numSamples,
+                                     FloatVector &maxSpectrum,
+                                     bool useSquelch) {
+  if (!workerPool)
+    return maxHold(frame, numSamples, maxSpectrum, useSquelch);
+
+  long numBlocks = numSamples / fftSize;
+
+  if (numBlocks <= 0 || (frame == NULL))
+    return 0;
+
+  bool squelch = useSquelch && (squelchThreshold != SQUELCH_DISABLE);
+  int numWorkers = parallelWorkers.size();
+
+  for (int w = 0; w < numWorkers; w++) {
+    ParallelWorker *pWorker = parallelWorkers[w];
+
+    for (int j = 0; j < fftSize; j++)
+      pWorker->maxSpectrum[j] = NOISE_FLOOR;
+
+    pWorker->firstActiveFrame = -1;
+  }
+
+  long numJobs = (numBlocks + grainFrames - 1) / grainFrames;
+
+  workerPool->run(numJobs, [&](int worker, long job) {
+    ParallelWorker *pWorker = parallelWorkers[worker];
+    float *pMax = &pWorker->maxSpectrum[0];
+    float *psd = pWorker->psd;
+    long firstRow = job * grainFrames;
+    long lastRow = firstRow + grainFrames;
+
+    if (lastRow > numBlocks)
+      lastRow = numBlocks;
+
+    for (long i = firstRow; i < lastRow; i++) {
+      computePSD(*pWorker->context, &frame[i * fftSize], psd,
+                 SQUELCH_DISABLE);
+
+      float frameMaxPower = SQUELCH_DISABLE;
+      float curPower;
+
+      for (int j = 0; j < fftSize; j++) {
+        curPower = psd[j];
+
+        if (curPower > frameMaxPower)
+          frameMaxPower = curPower;
+
+        if (squelch && (curPower <= squelchThreshold))
+          curPower = NOISE_FLOOR;
+
+        if (curPower >= pMax[j])
+          pMax[j] = curPower;
       }
-      if (psdSpectrum[j] > maxPower)
-        maxPower = psdSpectrum[j];
+
+      // A worker's jobs aren't in order, so keep the earliest
+      if ((frameMaxPower > squelchThreshold) &&
+          ((pWorker->firstActiveFrame < 0) || (i < pWorker->firstActiveFrame)))
+        pWorker->firstActiveFrame = i;
+    }
+  });
+
+  // Merge the partial max holds.  Max doesn't depend on order, so the result
+  // is the same however the jobs were split up.
+  if (maxSpectrum.size() != fftSize)
+    maxSpectrum.resize(fftSize);
+
+  memcpy(&maxSpectrum[0], &parallelWorkers[0]->maxSpectrum[0],
+         fftSize * sizeof(float));
+
+  firstActiveFrame = parallelWorkers[0]->firstActiveFrame;
+
+  for (int w = 1; w < numWorkers; w++) {
+    ParallelWorker *pWorker = parallelWorkers[w];
+    const float *pMax = &pWorker->maxSpectrum[0];
+
+    for (int j = 0; j < fftSize; j++) {
+      if (pMax[j] > maxSpectrum[j])
+        maxSpectrum[j] = pMax[j];
+    }
+
+    if ((pWorker->firstActiveFrame >= 0) &&
+        ((firstActiveFrame < 0) ||
+         (pWorker->firstActiveFrame < firstActiveFrame)))
+      firstActiveFrame = pWorker->firstActiveFrame;
+  }
+
+  lastFramesAnalyzed = numBlocks;
+
+  return (numBlocks * fftSize);
+}
+
+long EnergyAnalyzer::powerBinarySlicer(const SComplex *frame, long numSamples,
+                                       FloatVector &bits, float &rssi) {
+  long numBlocks = numSamples / fftSize;
+
+  rssi = NOISE_FLOOR;
+
+  if (numBlocks <= 0 || (frame == NULL))
+    return 0;
+
+  if (bits.size() != numBlocks) {
+    bits.resize(numBlocks);
+  }
+
+  float *pBit;
+  float maxPower;
+  int bucketswithPower;
+
+  pBit = &bits[0];
+
+  for (long i = 0; i < numBlocks; i++) {
+    // Each frame is a yes/no decision so we can stop counting once we have
+    // enough bins.
+    bucketswithPower =
+        countBinsOverThreshold(&frame[i * fftSize], requiredBins, maxPower);
+
+    if (bucketswithPower >= requiredBins) {
+      *pBit++ = 1;
+
+      if (maxPower > rssi)
+        rssi = maxPower;
+    } else {
+      *pBit++ = 0;
     }
+  }
+
+  return (numBlocks * fftSize);
+}
+
+bool EnergyAnalyzer::energyPresent(const SComplex *frame, long numSamples,
+                                   float &rssi) {
+  long numBlocks = numSamples / fftSize;
+
+  if (numBlocks <= 0 || (frame == NULL))
+    return 0;
+
+  float maxPower;
+  rssi = NOISE_FLOOR;
+
+  for (long i = 0; i < numBlocks; i++) {
+    int bucketswithPower =
+        countBinsOverThreshold(&frame[i * fftSize], requiredBins, maxPower);
+
+    if (maxPower > rssi)
+      rssi = maxPower;
+
+    if (bucketswithPower >= requiredBins)
+      return true; // return immediately
+  }
+
+  return false;
+}
+
+long EnergyAnalyzer::countEnergyBlocks(const SComplex *frame, long numSamples,
+                                       float &rssi) {
+  long numBlocks = numSamples / fftSize;
+
+  if (numBlocks <= 0 || (frame == NULL))
+    return 0;
+
+  long numEnergyBlocks = 0;
+  rssi = NOISE_FLOOR;
+  float maxPower;
 
-    float curDutyCycle = (float)bucketswithPower / (float)fftSize;
+  for (long i = 0; i < numBlocks; i++) {
+    int bucketswithPower =
+        countBinsOverThreshold(&frame[i * fftSize], requiredBins, maxPower);
 
-    if (curDutyCycle >= minDutyCycle) {
+    if (bucketswithPower >= requiredBins) {
       if (maxPower > rssi)
         rssi = maxPower;
 
@@ -694,14 +1372,85 @@ long EnergyAnalyzer::countEnergyBlocks(const SComplex *frame, long numSamples,
   return numEnergyBlocks;
 }
 
+void EnergyAnalyzer::setSharedSpectrum(const std::string &name) {
+  sharedName = name;
+
+  if (name.length() == 0)
+    sharedSpectrum.reset();
+  else
+    sharedSpectrum = SharedSpectrum::getInstance(name, fftSize, windowType);
+}
+
+void EnergyAnalyzer::setWindowType(int newWindowType) {
+  // Throws on an unknown type before anything changes
+  fftProc->setWindow(newWindowType);
+  windowType = newWindowType;
+
+  // Spectra are only shared between analyzers with the same window
+  if (sharedSpectrum)
+    setSharedSpectrum(sharedName);
+
+  lastMaxSpectrum.clear();
+}
+
+EnergyAnalyzer *EnergyAnalyzer::createReconfigured(int newFFTSize,
+                                                   int newWindowType) {
+  EnergyAnalyzer *newAnalyzer = new EnergyAnalyzer(
+      newFFTSize, squelchThreshold, minDutyCycle, false);
+
+  try {
+    newAnalyzer->setWindowType(newWindowType);
+  } catch (...) {
+    delete newAnalyzer;
+    throw;
+  }
+
+  newAnalyzer->setFrameStride(framesToAnalyze, frameStride, adaptiveStride);
+  newAnalyzer->setSharedSpectrum(sharedName);
+  newAnalyzer->setParallel(getParallelThreads(), grainFrames);
+
+  return newAnalyzer;
+}
+
+long EnergyAnalyzer::maxHold(const SComplex *frame, long numSamples,
+                             FloatVector &maxSpectrum, bool useSquelch) {
+  return maxHoldFrames(frame, SAMPLE_FORMAT_COMPLEX, numSamples, -1,
+                       maxSpectrum, useSquelch);
+}
+
 long EnergyAnalyzer::maxHold(const SComplex *frame, long numSamples,
+                             uint64_t startSample, FloatVector &maxSpectrum,
+                             bool useSquelch) {
+  int64_t firstFrame = -1;
+
+  // Frames only line up with other consumers on fftSize boundaries
+  if (sharedSpectrum && ((startSample % (uint64_t)fftSize) == 0))
+    firstFrame = (int64_t)(startSample / (uint64_t)fftSize);
+
+  return maxHoldFrames(frame, SAMPLE_FORMAT_COMPLEX, numSamples, firstFrame,
+                       maxSpectrum, useSquelch);
+}
+
+long EnergyAnalyzer::maxHold(const void *frame, int sampleFormat,
+                             long numSamples, int64_t startSample,
                              FloatVector &maxSpectrum, bool useSquelch) {
+  int64_t firstFrame = -1;
+
+  if (sharedSpectrum && (startSample >= 0) && ((startSample % fftSize) == 0))
+    firstFrame = startSample / fftSize;
+
+  return maxHoldFrames(frame, sampleFormat, numSamples, firstFrame,
+                       maxSpectrum, useSquelch);
+}
+
+long EnergyAnalyzer::maxHoldFrames(const void *frame, int sampleFormat,
+                                   long numSamples, int64_t firstFrame,
+                                   FloatVector &maxSpectrum, bool useSquelch) {
   long numBlocks = numSamples / fftSize;
 
   if (numBlocks <= 0 || (frame == NULL))
     return 0;
 
-  SComplex *fftInput;
   long index;
 
   if (maxSpectrum.size() != fftSize) {
@@ -713,24 +1462,72 @@ long EnergyAnalyzer::maxHold(const SComplex *frame, long numSamples,
     maxSpectrum[i] = NOISE_FLOOR;
   }
 
+  int sampleBytes = sampleFormatSize(sampleFormat);
+  bool striding = (frameStride > framesToAnalyze);
+  bool squelch = useSquelch && (squelchThreshold != SQUELCH_DISABLE);
+  float rawMaxPower = SQUELCH_DISABLE;
+  float frameMaxPower;
+  float curPower;
+
+  lastFramesAnalyzed = 0;
+  firstActiveFrame = -1;
+
   for (long i = 0; i < numBlocks; i++) {
-    // Calculate the FFT for the current block
+    if (striding && !analyzeFrame())
+      continue;
+
     index = i * fftSize;
-    fftInput = fftProc->getInputBuffer();
-    memcpy(fftInput, &frame[index], fftSize * sizeof(SComplex));
-    fftProc->execute();
 
-    // Get the PSD of the result with a squelch threshold
-    if (useSquelch)
-      fftProc->PowerSpectralDensity(psdSpectrum, squelchThreshold);
-    else
-      fftProc->PowerSpectralDensity(psdSpectrum, SQUELCH_DISABLE);
+    // Squelch is applied below rather than in the PSD so adaptive mode can
+    // see how close to the threshold the spectrum is (and so shared PSD's
+    // work with any threshold).
+    const void *block = (const char *)frame + index * sampleBytes;
+
+    if ((firstFrame < 0) ||
+        !sharedSpectrum->lookupPSD((uint64_t)firstFrame + i, psdSpectrum)) {
+      // Calculate the FFT for the current block
+      computePSD(*fftContext, block, sampleFormat, psdSpectrum,
+                 SQUELCH_DISABLE);
+
+      if (firstFrame >= 0)
+        sharedSpectrum->storePSD((uint64_t)firstFrame + i, psdSpectrum);
+    }
+
+    frameMaxPower = SQUELCH_DISABLE;
 
     for (int j = 0; j < fftSize; j++) {
-      if (psdSpectrum[j] >= maxSpectrum[j]) {
-        maxSpectrum[j] = psdSpectrum[j];
+      curPower = psdSpectrum[j];
+
+      if (curPower > frameMaxPower)
+        frameMaxPower = curPower;
+
+      if (squelch && (curPower <= squelchThreshold))
+        curPower = NOISE_FLOOR;
+
+      if (curPower >= maxSpectrum[j]) {
+        maxSpectrum[j] = curPower;
       }
     }
+
+    if (frameMaxPower > rawMaxPower)
+      rawMaxPower = frameMaxPower;
+
+    if ((firstActiveFrame < 0) && (frameMaxPower > squelchThreshold))
+      firstActiveFrame = i;
+
+    lastFramesAnalyzed++;
+  }
+
+  if (striding) {
+    if (lastFramesAnalyzed > 0) {
+      lastMaxSpectrum = maxSpectrum;
+
+      if (adaptiveStride)
+        updateStride(rawMaxPower);
+    } else if (lastMaxSpectrum.size() == fftSize) {
+      // Nothing analyzed this time.  Hold the last result.
+      maxSpectrum = lastMaxSpectrum;
+    }
   }
 
   return (numBlocks * fftSize);
@@ -938,7 +1735,372 @@ int EnergyAnalyzer::findSignals(const float *spectrum, double sampleRate,
   return signalVector.size();
 }
 
-} // namespace MesaSignals
-
 // -----------------  End Energy Analyzer
 // ---------------------------------------
+
+// -----------------  Start AnalyzerReconfig
+// ---------------------------------------
+void AnalyzerReconfig::queue(EnergyAnalyzer *&current, int newFFTSize,
+                             int newWindowType) {
+  boost::mutex::scoped_lock guard(buildMutex);
+
+  EnergyAnalyzer *newAnalyzer =
+      current->createReconfigured(newFFTSize, newWindowType);
+
+  // Only the newest request counts
+  delete pending.exchange(newAnalyzer, std::memory_order_acq_rel);
+}
+
+bool AnalyzerReconfig::swap(EnergyAnalyzer *&current) {
+  if (!isPending())
+    return false;
+
+  // Don't wait on a build in progress.  It'll be picked up next time.
+  boost::mutex::scoped_lock guard(buildMutex, boost::try_to_lock);
+
+  if (!guard.owns_lock())
+    return false;
+
+  EnergyAnalyzer *newAnalyzer =
+      pending.exchange(NULL, std::memory_order_acq_rel);
+
+  if (!newAnalyzer)
+    return false;
+
+  newAnalyzer->setThreshold(current->getThreshold());
+  newAnalyzer->setDutyCycle(current->getDutyCycle());
+
+  delete current;
+  current = newAnalyzer;
+
+  return true;
+}
+
+// -----------------  End AnalyzerReconfig
+// ---------------------------------------
+
+// -----------------  Start Signal Extractor
+// ---------------------------------------
+// Windowed sinc (Hamming) low pass with unity DC gain.  cutoff is in cycles
+// per sample and ntaps should be odd.
+static void lowPassTaps(int ntaps, double cutoff, std::vector<double> &taps) {
+  int halfTaps = (ntaps - 1) / 2;
+  std::vector<float> window = gr::fft::window::hamming(ntaps);
+  double tapSum = 0.0;
+
+  taps.resize(ntaps);
+
+  for (int m = -halfTaps; m <= halfTaps; m++) {
+    double x = 2.0 * M_PI * cutoff * (double)m;
+    double sinc = (m == 0) ? 1.0 : sin(x) / x;
+
+    taps[m + halfTaps] = 2.0 * cutoff * sinc * window[m + halfTaps];
+    tapSum += taps[m + halfTaps];
+  }
+
+  for (int i = 0; i < ntaps; i++)
+    taps[i] /= tapSum;
+}
+
+SignalExtractor::SignalExtractor(double initSampleRate) {
+  sampleRate = initSampleRate;
+}
+
+SignalExtractor::~SignalExtractor() {
+  std::map<int, FFT *>::iterator it;
+
+  for (it = forwardFFTs.begin(); it != forwardFFTs.end(); it++)
+    delete it->second;
+
+  for (it = inverseFFTs.begin(); it != inverseFFTs.end(); it++)
+    delete it->second;
+
+  forwardFFTs.clear();
+  inverseFFTs.clear();
+}
+
+int SignalExtractor::getDecimation(double widthHz) {
+  int decimation = 1;
+
+  while ((decimation * 2 <= EXTRACTOR_MAX_DECIMATION) &&
+         ((sampleRate / (double)(decimation * 2)) >=
+          (EXTRACTOR_OVERSAMPLE * widthHz)))
+    decimation *= 2;
+
+  return decimation;
+}
+
+int SignalExtractor::numTaps(int decimation) {
+  // Odd so the filter has a center tap
+  return ((int)(EXTRACTOR_TAPS_PER_DECIMATION * (double)decimation)) | 1;
+}
+
+FFT *SignalExtractor::getFFT(std::map<int, FFT *> &ffts, int direction,
+                             int fftSize) {
+  std::map<int, FFT *>::iterator it = ffts.find(fftSize);
+
+  if (it != ffts.end())
+    return it->second;
+
+  FFT *newFFT = new FFT(direction, fftSize);
+  ffts[fftSize] = newFFT;
+
+  return newFFT;
+}
+
+const ComplexVector &SignalExtractor::getFilter(int fftSize, int decimation) {
+  std::pair<int, int> key(fftSize, decimation);
+
+  std::map<std::pair<int, int>, ComplexVector>::iterator it =
+      filterResponses.find(key);
+
+  if (it != filterResponses.end())
+    return it->second;
+
+  // Windowed sinc low pass.  Cutoff is in the middle of the transition
+  // band (1/4 to 1/2 of the output rate).
+  int ntaps = numTaps(decimation);
+  int halfTaps = (ntaps - 1) / 2;
+  std::vector<double> taps;
+  lowPassTaps(ntaps, 0.375 / (double)decimation, taps);
+
+  // Center the taps on sample 0 (wrapping the negative side to the end) so
+  // the filter is zero phase.
+  FFT *fftProc = getFFT(forwardFFTs, FFTDIRECTION_FORWARD, fftSize);
+  SComplex *fftInput = fftProc->getInputBuffer();
+  memset(fftInput, 0x00, fftSize * sizeof(SComplex));
+
+  for (int m = -halfTaps; m <= halfTaps; m++) {
+    int index = (m + fftSize) % fftSize;
+    fftInput[index] =
+        SComplex(taps[m + halfTaps] / (double)fftSize, 0.0);
+  }
+
+  fftProc->execute();
+
+  SComplex *fftOutput = fftProc->getOutputBuffer();
+  ComplexVector &response = filterResponses[key];
+  response.assign(fftOutput, fftOutput + fftSize);
+
+  return response;
+}
+
+void SignalExtractor::extract(const SComplex *in, long numSamples,
+                              ExtractedSignalVector &signals) {
+  int numSignals = signals.size();
+
+  if ((numSignals == 0) || (numSamples <= 0) || (in == NULL))
+    return;
+
+  // One FFT size and hop for the whole block so the forward FFTs can be
+  // shared.  They're sized for the largest decimation (longest filter).
+  int maxDecimation = 1;
+  std::vector<int> centerBins(numSignals);
+
+  for (int i = 0; i < numSignals; i++) {
+    signals[i].decimation = getDecimation(signals[i].widthHz);
+    signals[i].sampleRate = sampleRate / (double)signals[i].decimation;
+
+    if (signals[i].decimation > maxDecimation)
+      maxDecimation = signals[i].decimation;
+  }
+
+  int maxTaps = numTaps(maxDecimation);
+  int fftSize = EXTRACTOR_MIN_FFT;
+
+  while (fftSize < 4 * maxTaps)
+    fftSize *= 2;
+
+  // Keep hop and overlap multiples of 2 * maxDecimation so both split evenly
+  // across every channel's decimation, and the overlap is split evenly on
+  // either side of the kept samples (zero phase filter).
+  int hopMultiple = 2 * maxDecimation;
+  int hop = ((fftSize - (maxTaps - 1)) / hopMultiple) * hopMultiple;
+  int overlap = fftSize - hop;
+  int halfOverlap = overlap / 2;
+
+  // getFilter runs the forward FFT on a cache miss, so every filter has to be
+  // ready before the segments start using that FFT.  Map entries don't move,
+  // so the pointers stay good.
+  std::vector<const ComplexVector *> filters(numSignals);
+
+  for (int i = 0; i < numSignals; i++) {
+    filters[i] = &getFilter(fftSize, signals[i].decimation);
+
+    // Closest bin to the signal center (0 to fftSize-1)
+    long bin = lround(signals[i].offsetHz / sampleRate * (double)fftSize);
+    long wrapped = ((bin % fftSize) + fftSize) % fftSize;
+    centerBins[i] = (int)wrapped;
+
+    signals[i].tunedOffsetHz = (double)bin * sampleRate / (double)fftSize;
+    signals[i].data.resize(numSamples / signals[i].decimation);
+  }
+
+  FFT *forward = getFFT(forwardFFTs, FFTDIRECTION_FORWARD, fftSize);
+  long numSegments = (numSamples + hop - 1) / hop;
+
+  for (long k = 0; k < numSegments; k++) {
+    // Segment k's kept samples are input [k * hop, (k+1) * hop)
+    long segmentStart = k * hop - halfOverlap;
+    long copyStart = segmentStart < 0 ? 0 : segmentStart;
+    long copyEnd = segmentStart + fftSize;
+
+    if (copyEnd > numSamples)
+      copyEnd = numSamples;
+
+    SComplex *fftInput = forward->getInputBuffer();
+    memset(fftInput, 0x00, fftSize * sizeof(SComplex));
+
+    if (copyEnd > copyStart)
+      memcpy(&fftInput[copyStart - segmentStart], &in[copyStart],
+             (copyEnd - copyStart) * sizeof(SComplex));
+
+    forward->execute();
+    const SComplex *spectrum = forward->getOutputBuffer();
+
+    for (int i = 0; i < numSignals; i++) {
+      int decimation = signals[i].decimation;
+      int channelSize = fftSize / decimation;
+      int halfChannel = channelSize / 2;
+      int c = centerBins[i];
+      const ComplexVector &filter = *filters[i];
+
+      // Pull out the bins around the signal, filter them, and put them in
+      // baseband order for the smaller inverse FFT.
+      FFT *inverse = getFFT(inverseFFTs, FFTDIRECTION_BACKWARD, channelSize);
+      SComplex *channelIn = inverse->getInputBuffer();
+
+      for (int b = 0; b < channelSize; b++) {
+        int relBin = (b < halfChannel) ? b : b - channelSize;
+        int srcBin = (c + relBin + fftSize) % fftSize;
+        int filterBin = (relBin + fftSize) % fftSize;
+
+        channelIn[b] = spectrum[srcBin] * filter[filterBin];
+      }
+
+      inverse->execute();
+      const SComplex *channelOut = inverse->getOutputBuffer();
+
+      // Rotating bins shifts relative to the segment start.  Correct the
+      // phase so it's continuous across segments.
+      long long phaseIndex = ((long long)c * (long long)segmentStart) % fftSize;
+      double phase = -2.0 * M_PI * (double)phaseIndex / (double)fftSize;
+      SComplex phaseCorrection((float)cos(phase), (float)sin(phase));
+
+      long outStart = (k * hop) / decimation;
+      long outCount = hop / decimation;
+      long outSize = signals[i].data.size();
+
+      if (outStart + outCount > outSize)
+        outCount = outSize - outStart;
+
+      if (outCount <= 0)
+        continue;
+
+      volk_32fc_s32fc_multiply_32fc(&signals[i].data[outStart],
+                                    &channelOut[halfOverlap / decimation],
+                                    phaseCorrection, outCount);
+    }
+  }
+}
+
+// -----------------  End Signal Extractor
+// ---------------------------------------
+
+// -----------------  Start Zoom Decimator
+// ---------------------------------------
+ZoomDecimator::ZoomDecimator(int initDecimation) {
+  if (initDecimation < 1)
+    throw std::out_of_range("[ZoomDecimator] decimation must be >= 1");
+
+  decimation = initDecimation;
+
+  // Odd so the filter has a center tap.  The cutoff is the output Nyquist
+  // rate: the passband reaches 1/4 of the output rate and anything past 3/4
+  // is in the stop band, so aliases only fold into the outer quarters.
+  numTaps = ((int)(ZOOM_TAPS_PER_DECIMATION * (double)decimation)) | 1;
+
+  std::vector<double> designTaps;
+  lowPassTaps(numTaps, 0.5 / (double)decimation, designTaps);
+
+  size_t memAlignment = volk_get_alignment();
+  taps = (float *)volk_malloc(numTaps * sizeof(float), memAlignment);
+
+  // Symmetric, so these don't need to be reversed for the dot product
+  for (int i = 0; i < numTaps; i++)
+    taps[i] = (float)designTaps[i];
+
+  workBuffer = NULL;
+  workBufferSize = 0;
+}
+
+ZoomDecimator::~ZoomDecimator() {
+  if (taps) {
+    volk_free(taps);
+    taps = NULL;
+  }
+
+  if (workBuffer) {
+    volk_free(workBuffer);
+    workBuffer = NULL;
+  }
+}
+
+int ZoomDecimator::selectDecimation(double sampleRate, double halfWidthHz,
+                                    int fftSize) {
+  int decimation = 1;
+
+  while (((fftSize % (decimation * 2)) == 0) &&
+         ((fftSize / (decimation * 2)) >= ZOOM_MIN_FFT) &&
+         ((sampleRate / (double)(decimation * 2)) >= (4.0 * halfWidthHz)))
+    decimation *= 2;
+
+  return decimation;
+}
+
+void ZoomDecimator::reset() {
+  if (workBuffer)
+    memset(workBuffer, 0x00, (numTaps - 1) * sizeof(SComplex));
+}
+
+long ZoomDecimator::decimate(const SComplex *in, long numSamples,
+                             SComplex *out) {
+  long history = numTaps - 1;
+
+  if ((history + numSamples) > workBufferSize) {
+    size_t memAlignment = volk_get_alignment();
+    SComplex *newBuffer = (SComplex *)volk_malloc(
+        (history + numSamples) * sizeof(SComplex), memAlignment);
+
+    if (workBuffer) {
+      memcpy(newBuffer, workBuffer, history * sizeof(SComplex));
+      volk_free(workBuffer);
+    } else {
+      memset(newBuffer, 0x00, history * sizeof(SComplex));
+    }
+
+    workBuffer = newBuffer;
+    workBufferSize = history + numSamples;
+  }
+
+  memcpy(&workBuffer[history], in, numSamples * sizeof(SComplex));
+
+  // Output i is the filter ending on input sample i * decimation
+  long numOutputs = numSamples / decimation;
+
+  for (long i = 0; i < numOutputs; i++)
+    volk_32fc_32f_dot_prod_32fc((lv_32fc_t *)&out[i],
+                                (const lv_32fc_t *)&workBuffer[i * decimation],
+                                taps, numTaps);
+
+  // Keep the tail as history for the next call
+  memmove(workBuffer, &workBuffer[numSamples], history * sizeof(SComplex));
+
+  return numOutputs;
+}
+
+// -----------------  End Zoom Decimator
+// ---------------------------------------
+
+} // namespace MesaSignals
+// ---------------------------------------
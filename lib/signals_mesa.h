@@ -10,8 +10,16 @@
 #define LIB_SIGNALS_MESA_H_
 
 #include "scomplex.h"
+#include <atomic>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <cmath>
 #include <fftw3.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdint.h>
 #include <volk/volk.h>
 
 typedef std::vector<float> FloatVector;
@@ -28,6 +36,49 @@ typedef std::vector<float> FloatVector;
 #define SQUELCH_DISABLE -1000.0
 #define NOISE_FLOOR -100.0
 
+// Adaptive frame analysis goes back to analyzing every frame once the max
+// power gets within this many dB of the squelch threshold.
+#define ENERGY_ADAPTIVE_MARGIN_DB 6.0
+
+// Bins are compared against the threshold this many at a time between checks
+// for an early exit in the duty cycle counters.
+#define ENERGY_COUNT_CHUNK 64
+
+// Number of independent accumulators per statistic in the spectrum stats
+// kernel.  Splitting the reductions this way lets the compiler keep them in
+// vector registers.
+#define SPECTRUM_STATS_LANES 8
+
+// Default number of frames each worker takes at a time in the parallel
+// EnergyAnalyzer calls.
+#define ENERGY_PARALLEL_GRAIN 16
+
+// Number of PSD frames a SharedSpectrum keeps around.  Consumers that fall
+// further behind than this just recompute their frames.
+#define SHARED_SPECTRUM_FRAMES 256
+
+// SignalExtractor settings.  The output sample rate is at least
+// EXTRACTOR_OVERSAMPLE x the signal width.  Filter length grows with the
+// decimation (roughly 3.3 / normalized transition width for a Hamming
+// window).
+#define EXTRACTOR_OVERSAMPLE 2.0
+#define EXTRACTOR_MAX_DECIMATION 4096
+#define EXTRACTOR_TAPS_PER_DECIMATION 13.2
+#define EXTRACTOR_MIN_FFT 256
+
+// ZoomDecimator settings.  The filter only has to keep aliases out of the
+// inner half of the output band, so its transition band is 2x wider than the
+// extractor's and it needs half the taps.  The zoomed FFT is kept to at
+// least ZOOM_MIN_FFT bins.
+#define ZOOM_TAPS_PER_DECIMATION 6.6
+#define ZOOM_MIN_FFT 64
+
+// Input sample formats.  The integer formats are interleaved I/Q as most
+// SDR's deliver them (sc16 / sc8) and are scaled to +/-1.0 full scale.
+#define SAMPLE_FORMAT_COMPLEX 1
+#define SAMPLE_FORMAT_SC16 2
+#define SAMPLE_FORMAT_SC8 3
+
 using namespace std;
 
 namespace MesaSignals {
@@ -35,9 +86,78 @@ namespace MesaSignals {
 void printArray(FloatVector &arr, string name);
 void printArray(float *arr, int arrSize, string name);
 
+// Bytes per complex sample and the full-scale multiplier for a sample format
+inline int sampleFormatSize(int sampleFormat) {
+  switch (sampleFormat) {
+  case SAMPLE_FORMAT_SC16:
+    return 2 * sizeof(int16_t);
+  case SAMPLE_FORMAT_SC8:
+    return 2 * sizeof(int8_t);
+  default:
+    return sizeof(SComplex);
+  }
+}
+
+inline float sampleFormatScale(int sampleFormat) {
+  switch (sampleFormat) {
+  case SAMPLE_FORMAT_SC16:
+    return 1.0f / 32768.0f;
+  case SAMPLE_FORMAT_SC8:
+    return 1.0f / 128.0f;
+  default:
+    return 1.0f;
+  }
+}
+
+// Coherent gain (sum of the taps / N) of a WINDOWTYPE_*.  A tone's FFT bin
+// is scaled by this, so it's the window's loss on the spectrum's dB scale.
+inline float windowCoherentGain(int windowType) {
+  switch (windowType) {
+  case WINDOWTYPE_HAMMING:
+    return 0.54f;
+  case WINDOWTYPE_BLACKMAN_HARRIS:
+    return 0.35875f;
+  default:
+    return 1.0f;
+  }
+}
+
+// Converts numSamples of sampleFormat data to complex.  For when the float
+// samples really are needed (e.g. PDU's), not for the analysis path.
+void convertToComplex(const void *in, int sampleFormat, long numSamples,
+                      SComplex *out);
+
 /*
  * FFT Transforms
  */
+
+/*
+ * Per-thread FFT scratch space (input, output, and DC swap buffers).  An FFT's
+ * plan and window are shared and only read while executing, so any number of
+ * threads can run the same FFT at the same time without a lock as long as
+ * each one uses its own context.
+ */
+class FFTContext {
+public:
+  FFTContext(int initFFTSize);
+  virtual ~FFTContext();
+
+  FFTContext(const FFTContext &) = delete;
+  FFTContext &operator=(const FFTContext &) = delete;
+
+  inline int size() const { return fftSize; };
+  inline SComplex *getInputBuffer() { return inputBuffer; };
+  inline SComplex *getOutputBuffer() { return outputBuffer; };
+
+protected:
+  friend class FFT;
+
+  int fftSize;
+  SComplex *inputBuffer;
+  SComplex *outputBuffer;
+  float *tmpBuff; // Used for swapping to center DC in spectrums
+};
+
 class FFT {
 public:
   // Actually it appears to get better performance, at least for 1024 sample
@@ -49,9 +169,16 @@ public:
   inline int inputBufferLength() const { return fftSize; }
   inline int outputBufferLength() const { return fftSize; }
 
+  // These use the FFT's own context and are for single-threaded use.
   inline SComplex *getInputBuffer() { return inputBuffer; };
   inline SComplex *getOutputBuffer() { return outputBuffer; };
 
+  // A new context sized for this FFT.  The caller owns it.
+  inline FFTContext *createContext() { return new FFTContext(fftSize); };
+
+  // Window changes are published atomically, so it's safe to change the
+  // window while other threads are executing.  Each execute sees either the
+  // old or the new window.
   virtual void setWindow(int winType);
   // Note: For this setWindow, the length of newTaps should be fftSize
   virtual void setWindow(FloatVector &newTaps);
@@ -67,6 +194,18 @@ public:
   // Passing NULL will disable windowing for this run.
   inline void execute(float *pTaps, bool shift = false);
 
+  // Same as above, but on context's buffers.  These are thread-safe.
+  void execute(FFTContext &context, bool shift = false);
+  void execute(FFTContext &context, float *pTaps, bool shift = false);
+
+  // Loads fftSize interleaved integer I/Q samples straight into context's
+  // input buffer, converting, scaling, and windowing them in one pass, then
+  // executes.  A full-scale float copy of the input is never made.
+  void executeInterleaved(FFTContext &context, const int16_t *iq, float scale,
+                          bool shift = false);
+  void executeInterleaved(FFTContext &context, const int8_t *iq, float scale,
+                          bool shift = false);
+
   // So PSD computes power in dBm which is basically the RSSI.
   // PowerSpectralDensity: Call Execute first, then call this function
   // to compute PSD and store it in the provided psdBuffer buffer
@@ -83,7 +222,32 @@ public:
   void rssi(float *psdBuffer, float squelchThreshold = SQUELCH_DISABLE,
             float onSquelchSetRSSI = NOISE_FLOOR);
 
+  // Context versions of the above for use after execute(context)
+  void PowerSpectralDensity(FFTContext &context, float *psdBuffer,
+                            float squelchThreshold = SQUELCH_DISABLE,
+                            float onSquelchSetRSSI = NOISE_FLOOR);
+  void rssi(FFTContext &context, float *psdBuffer,
+            float squelchThreshold = SQUELCH_DISABLE,
+            float onSquelchSetRSSI = NOISE_FLOOR);
+
+  // MagnitudeSquared: Call Execute first.  Computes |X|^2 per bin with no
+  // log10 and no DC centering (bin 0 is DC).  This is for cases where only
+  // threshold comparisons are needed.  PowerSpectralDensity is
+  // 10log10(|X|^2 / N^2), so use linearPower() to convert a dB threshold to
+  // this scale.
+  void MagnitudeSquared(float *magBuffer);
+  void MagnitudeSquared(FFTContext &context, float *magBuffer);
+
+  // Convert between PowerSpectralDensity dB and MagnitudeSquared values.
+  inline float linearPower(float powerDB) {
+    return (float)fftSize * (float)fftSize * powf(10.0f, powerDB / 10.0f);
+  };
+  inline float powerDB(float linear) {
+    return 10.0f * log10f(linear / ((float)fftSize * (float)fftSize));
+  };
+
 protected:
+  // Only taken when changing the window.  execute doesn't lock.
   boost::mutex d_mutex;
 
   float log2To10Factor;
@@ -95,12 +259,19 @@ protected:
   void *fftPlan;
   int fftDirection;
 
-  float *alignedWindowTaps;
-  bool hasTaps = false;
+  // The current window taps (NULL for no window).  setWindow never changes
+  // taps in place.  It fills a new buffer and swaps the pointer, and old
+  // buffers are kept in windowBuffers until the FFT is deleted since another
+  // thread may still be using them.
+  std::atomic<float *> windowTaps;
+  std::vector<float *> windowBuffers;
+
+  void publishWindow(const float *taps);
 
+  // The FFT's own context, used by the non-context calls
+  FFTContext *defaultContext;
   SComplex *inputBuffer;
   SComplex *outputBuffer;
-  float *tmpBuff; // Used for swapping to center DC in spectrums
   int fftLenBytes;
   int halfFFTSizeBytes;
   int halfFFTSize;
@@ -131,6 +302,31 @@ public:
 
 typedef std::vector<SpectrumOverview> SpectrumOverviewVector;
 
+// Structure-of-arrays version of SpectrumOverviewVector.  Entry i of each
+// array describes row i of the analyzed waterfall.  Reuse the same batch
+// between calls and the arrays only grow when more rows are needed.
+class SpectrumOverviewBatch {
+public:
+  SpectrumOverviewBatch() { numRows = 0; };
+  virtual ~SpectrumOverviewBatch(){};
+
+  long numRows;
+
+  FloatVector dutyCycle;
+  FloatVector maxPower;
+  FloatVector minPower;
+  FloatVector centerAvgPower;
+  FloatVector avgPower;
+  FloatVector minPowerOverThreshold;
+
+  virtual void resize(long newNumRows);
+  inline long size() const { return numRows; };
+  inline void clear() { numRows = 0; };
+
+  // Copy row i out as a SpectrumOverview
+  void getOverview(long i, SpectrumOverview &overview) const;
+};
+
 class SignalOverview {
 public:
   SignalOverview(){};
@@ -169,6 +365,106 @@ public:
 
 typedef std::vector<SignalOverview> SignalOverviewVector;
 
+/*
+ * SharedSpectrum
+ *
+ * Lets several EnergyAnalyzers looking at the same stream share one set of
+ * FFT/PSD calculations.  Frames are identified by their absolute frame index
+ * in the stream (sample offset / fftSize).  The first consumer to ask for a
+ * frame computes it.  Later consumers get a copy of the cached PSD.
+ *
+ * Instances are looked up by name through getInstance.  Every consumer using
+ * the same name must be fed the same stream from the same output.
+ * Otherwise they'd be sharing spectra for different data.
+ */
+class SharedSpectrum {
+public:
+  SharedSpectrum(int initFFTSize, int numFrames = SHARED_SPECTRUM_FRAMES);
+  virtual ~SharedSpectrum();
+
+  // Returns the shared instance for name/fftSize/windowType, creating it if
+  // no one else is currently holding one.  The window is part of the key so
+  // analyzers only share PSD's computed the same way.
+  static std::shared_ptr<SharedSpectrum>
+  getInstance(const std::string &name, int fftSize, int windowType);
+
+  // Consumers compute PSD's (DC centered, no squelch) on their own FFT
+  // contexts, outside of the cache lock.  lookupPSD copies out the cached PSD
+  // for frameIndex and returns true if there is one.  Otherwise the caller
+  // computes it and hands it to storePSD for everyone else.
+  bool lookupPSD(uint64_t frameIndex, float *psdBuffer);
+  void storePSD(uint64_t frameIndex, const float *psdBuffer);
+
+  inline int getFFTSize() { return fftSize; };
+
+  inline uint64_t getFramesComputed() {
+    boost::mutex::scoped_lock guard(d_mutex);
+    return framesComputed;
+  };
+
+  inline uint64_t getFramesShared() {
+    boost::mutex::scoped_lock guard(d_mutex);
+    return framesShared;
+  };
+
+protected:
+  boost::mutex d_mutex;
+
+  int fftSize;
+  int numFrames;
+
+  // numFrames x fftSize PSD's and the frame index in each slot
+  float *spectra;
+  std::vector<uint64_t> slotFrame;
+  std::vector<bool> slotValid;
+
+  uint64_t framesComputed;
+  uint64_t framesShared;
+};
+
+/*
+ * WorkerPool
+ *
+ * A fixed set of threads for splitting a batch of independent jobs.  run()
+ * hands out job indexes from a shared counter until they're all taken and
+ * returns once every job is done.  The calling thread works too (as worker 0),
+ * so a pool of n workers only starts n - 1 threads.
+ */
+class WorkerPool {
+public:
+  typedef std::function<void(int worker, long job)> JobFunction;
+
+  WorkerPool(int initNumWorkers);
+  virtual ~WorkerPool();
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  inline int size() const { return numWorkers; };
+
+  // Calls job(worker, j) for every j in [0, numJobs).  Not reentrant: only
+  // one thread should call run at a time.
+  void run(long numJobs, const JobFunction &job);
+
+protected:
+  boost::mutex d_mutex;
+  boost::condition_variable workReady;
+  boost::condition_variable workDone;
+
+  int numWorkers;
+  std::vector<boost::thread *> threads;
+
+  const JobFunction *curJob;
+  long totalJobs;
+  std::atomic<long> nextJob;
+  int busyWorkers;
+  uint64_t generation;
+  bool shuttingDown;
+
+  void workerLoop(int worker);
+  void runJobs(int worker);
+};
+
 /*
  * EnergyAnalyzer class
  */
@@ -179,8 +475,90 @@ protected:
   float squelchThreshold;
   float minDutyCycle;
 
+  // The squelch threshold as a MagnitudeSquared value and the number of bins
+  // that have to be over it to meet the duty cycle.  Kept in sync by
+  // setThreshold and setDutyCycle.
+  float linearThreshold;
+  int requiredBins;
+
   FFT *fftProc;
+  FFTContext *fftContext;
   float *psdSpectrum;
+  int windowType;
+
+  // If set, maxHold gets its PSD's from here when it knows the stream
+  // position.
+  std::shared_ptr<SharedSpectrum> sharedSpectrum;
+  std::string sharedName;
+
+  // Strided analysis: maxHold only runs the FFT on framesToAnalyze of every
+  // curStride frames.  In adaptive mode curStride drops to framesToAnalyze
+  // (every frame) when energy is near the threshold and doubles back up to
+  // frameStride while the band is idle.
+  int framesToAnalyze;
+  int frameStride;
+  int curStride;
+  int frameCounter;
+  bool adaptiveStride;
+  long lastFramesAnalyzed;
+  long firstActiveFrame;
+  FloatVector lastMaxSpectrum;
+
+  inline bool analyzeFrame() {
+    if (curStride <= framesToAnalyze)
+      return true;
+
+    bool analyze = (frameCounter < framesToAnalyze);
+
+    frameCounter++;
+    if (frameCounter >= curStride)
+      frameCounter = 0;
+
+    return analyze;
+  };
+
+  void updateStride(float maxPower);
+
+  // Runs the FFT on one frame and counts bins over the squelch threshold in
+  // the linear domain.  Counting stops once stopAt bins have been found.
+  // maxPower is set to the frame's peak in dB if it's over the threshold,
+  // otherwise NOISE_FLOOR.
+  int countBinsOverThreshold(const SComplex *frame, int stopAt,
+                             float &maxPower);
+
+  // Common maxHold implementation.  frame is sampleFormat data.  firstFrame
+  // is the absolute frame index of frame in the stream or -1 if it isn't
+  // known (no sharing).
+  long maxHoldFrames(const void *frame, int sampleFormat, long numSamples,
+                     int64_t firstFrame, FloatVector &maxSpectrum,
+                     bool useSquelch);
+
+  // PSD rows for analyze() and a batch used by the vector version.
+  WaterfallData psdRows;
+  SpectrumOverviewBatch overviewBatch;
+
+  // Computes the statistics for rows [firstRow, firstRow + numRows) of
+  // spectra into the same rows of results (which must already be sized).
+  void analyzeRows(const float *spectra, long firstRow, long numRows,
+                   SpectrumOverviewBatch &results);
+
+  // Parallel batch mode.  Each worker has its own FFT context and scratch.
+  class ParallelWorker {
+  public:
+    ParallelWorker(FFT *fftProc, int fftSize);
+    virtual ~ParallelWorker();
+
+    FFTContext *context;
+    float *psd;
+    FloatVector maxSpectrum;
+    long firstActiveFrame;
+  };
+
+  WorkerPool *workerPool;
+  std::vector<ParallelWorker *> parallelWorkers;
+  long grainFrames;
+
+  void clearParallel();
 
 public:
   // squelch threshold should be a number like -75.0
@@ -189,16 +567,82 @@ public:
                  float initMinDutyCycle, bool useWindow = true);
   virtual ~EnergyAnalyzer();
 
-  inline void setThreshold(float newThreshold) {
-    squelchThreshold = newThreshold;
-  };
+  void setThreshold(float newThreshold);
   inline float getThreshold() { return squelchThreshold; };
-  inline void setDutyCycle(float newDutyCycle) { minDutyCycle = newDutyCycle; };
+  void setDutyCycle(float newDutyCycle);
   inline float getDutyCycle() { return minDutyCycle; };
 
   inline float getFFTSize() { return fftSize; };
+
+  // WINDOWTYPE_*.  Safe to change while another thread is running the FFT.
+  void setWindowType(int newWindowType);
+  inline int getWindowType() { return windowType; };
+
+  // Builds a new analyzer with a different FFT size and/or window and the
+  // rest of this one's settings (threshold, duty cycle, frame stride, shared
+  // spectrum name, parallel mode).  The FFT plan comes from the wisdom file
+  // when it's there, but this can still take a while so it shouldn't be
+  // called from work().
+  EnergyAnalyzer *createReconfigured(int newFFTSize, int newWindowType);
+
+  // Only analyze analyzeFrames of every everyFrames FFT frames in maxHold.
+  // Frames that are skipped never go through the FFT.  If a call skips every
+  // frame, maxHold returns the last max spectrum it computed.  With adaptive
+  // set, all frames are analyzed while energy is within
+  // ENERGY_ADAPTIVE_MARGIN_DB of the squelch threshold, backing off to the
+  // configured stride when the band is idle.
+  void setFrameStride(int analyzeFrames, int everyFrames,
+                      bool adaptive = false);
+  inline int getCurrentStride() { return curStride; };
+
+  // Number of frames that actually went through the FFT on the last maxHold
+  inline long getLastFramesAnalyzed() { return lastFramesAnalyzed; };
+
+  // Index of the first frame in the last maxHold with a bin over the squelch
+  // threshold (-1 if there wasn't one).  Frame * fftSize is the sample offset
+  // where the energy showed up.
+  inline long getFirstActiveFrame() { return firstActiveFrame; };
   inline FFT *getFFTProcessor() { return fftProc; };
 
+  // Computes the PSD (DC centered) of one fftSize frame into psd using
+  // context for scratch.  This only reads the analyzer's FFT plan and window,
+  // so several threads can call it at once, each with its own context from
+  // createContext().
+  void computePSD(FFTContext &context, const SComplex *frame, float *psd,
+                  float squelch = SQUELCH_DISABLE);
+
+  // Same as above for a frame of any SAMPLE_FORMAT_*.  Integer samples are
+  // scaled and windowed as they're loaded into the FFT.
+  void computePSD(FFTContext &context, const void *frame, int sampleFormat,
+                  float *psd, float squelch = SQUELCH_DISABLE);
+  inline FFTContext *createContext() { return fftProc->createContext(); };
+
+  // Parallel batch mode for large offline/high-rate frames.  The *Parallel
+  // calls split the frame into chunks of grainFrames FFT frames and spread
+  // them over numThreads workers (the calling thread counts as one), then
+  // merge the results.  Output is in frame order and the same as the serial
+  // calls no matter how the chunks were scheduled.  numThreads of 1 turns it
+  // off and the *Parallel calls run serially.
+  void setParallel(int numThreads, long grain = ENERGY_PARALLEL_GRAIN);
+  inline int getParallelThreads() {
+    return workerPool ? workerPool->size() : 1;
+  };
+  inline long getParallelGrain() { return grainFrames; };
+
+  // Same as analyze(frame, numSamples, SpectrumOverviewBatch&).  Each chunk's
+  // PSD rows are computed and summarized by the same worker.
+  long analyzeParallel(const SComplex *frame, long numSamples,
+                       SpectrumOverviewBatch &results);
+
+  // Same as getWaterfall.  waterfallData must already be sized for the frame.
+  long getWaterfallParallel(const SComplex *frame, long numSamples,
+                            WaterfallData &waterfallData);
+
+  // Same as the unshared maxHold, but every frame is analyzed (no frame
+  // stride).  Each worker keeps a partial max hold that's merged at the end.
+  long maxHoldParallel(const SComplex *frame, long numSamples,
+                       FloatVector &maxSpectrum, bool useSquelch = true);
+
   // Analyze chunks through frame and for each FFTSize block returns a
   // spectrumOverview object which describes duty cycle, max power, avg power,
   // etc. Think of it as an analysis/summary of each row in a waterfall plot.
@@ -207,11 +651,41 @@ public:
   virtual long analyze(const SComplex *frame, long numSamples,
                        SpectrumOverviewVector &results);
 
+  // Same as above but the results go into a structure-of-arrays batch with no
+  // per-row allocations.  All of the PSD rows are computed first, then the
+  // statistics for every row are computed in a single pass over each row.
+  virtual long analyze(const SComplex *frame, long numSamples,
+                       SpectrumOverviewBatch &results);
+
+  // Runs the analyzeSpectrum statistics over numRows fftSize-long spectra
+  // stored back to back (e.g. WaterfallData::data) into results.
+  void analyzeSpectra(const float *spectra, long numRows,
+                      SpectrumOverviewBatch &results);
+
   // maxHold computes the max spectrum curve for the given frame.  Return value
   // is the number of samples processed.
   virtual long maxHold(const SComplex *frame, long numSamples,
                        FloatVector &maxSpectrum, bool useSquelch = true);
 
+  // Same as above, but startSample is the stream offset of frame (e.g.
+  // nitems_read(0)).  If a shared spectrum is set, frames other analyzers
+  // have already computed are reused rather than recomputed.
+  virtual long maxHold(const SComplex *frame, long numSamples,
+                       uint64_t startSample, FloatVector &maxSpectrum,
+                       bool useSquelch = true);
+
+  // maxHold for SAMPLE_FORMAT_* input (e.g. sc16 straight from a radio).
+  // numSamples is in complex samples.  startSample works as above, or pass
+  // -1 if the stream position isn't known.
+  virtual long maxHold(const void *frame, int sampleFormat, long numSamples,
+                       int64_t startSample, FloatVector &maxSpectrum,
+                       bool useSquelch = true);
+
+  // Share FFT's with any other analyzer using the same name, FFT size, and
+  // window.  An empty name stops sharing.
+  void setSharedSpectrum(const std::string &name);
+  inline bool isShared() { return (bool)sharedSpectrum; };
+
   // maxPower will look through a spectrum (something from maxHold or psd/rssi
   // from FFT and find the max value
   float maxPower(FloatVector &maxSpectrum);
@@ -272,6 +746,145 @@ public:
   long countEnergyBlocks(const SComplex *frame, long numSamples, float &rssi);
 };
 
+/*
+ * AnalyzerReconfig
+ *
+ * Swaps a block's EnergyAnalyzer for one with a different FFT size or window
+ * while the flowgraph is running.  queue() is called from the setter and does
+ * the slow part (building the analyzer and planning its FFT).  swap() is
+ * called by the work thread at the start of a block and only exchanges
+ * pointers, so no samples are held up while the new FFT is planned.
+ */
+class AnalyzerReconfig {
+public:
+  AnalyzerReconfig() { pending.store(NULL); };
+  virtual ~AnalyzerReconfig() { delete pending.exchange(NULL); };
+
+  // Builds a replacement for current with current's settings.  current is
+  // only read while the build lock is held, so swap() can't change it in the
+  // middle.  If a replacement was already waiting, it's replaced.
+  void queue(EnergyAnalyzer *&current, int newFFTSize, int newWindowType);
+
+  // If a replacement is ready, brings over the current threshold and duty
+  // cycle (they may have changed since it was built), deletes current, and
+  // sets current to the replacement.  Returns true if it swapped.
+  bool swap(EnergyAnalyzer *&current);
+
+  inline bool isPending() {
+    return pending.load(std::memory_order_acquire) != NULL;
+  };
+
+protected:
+  boost::mutex buildMutex;
+  std::atomic<EnergyAnalyzer *> pending;
+};
+
+/*
+ * Signal Extractor
+ */
+class ExtractedSignal {
+public:
+  ExtractedSignal(){};
+  virtual ~ExtractedSignal(){};
+
+  // Set by the caller: where the signal is relative to the center of the
+  // wideband data and how wide it is.
+  double offsetHz = 0.0;
+  double widthHz = 0.0;
+
+  // Set by extract().  The output is tuned to the FFT bin closest to
+  // offsetHz, so tunedOffsetHz is what's actually at 0 Hz in data.
+  double tunedOffsetHz = 0.0;
+  int decimation = 1;
+  double sampleRate = 0.0;
+  ComplexVector data;
+};
+
+typedef std::vector<ExtractedSignal> ExtractedSignalVector;
+
+/*
+ * Fast convolution (overlap-save) filterbank that pulls narrowband signals out
+ * of a wideband block.  Each signal is shifted to baseband by rotating FFT
+ * bins, low-pass filtered in the frequency domain, and decimated by taking a
+ * smaller inverse FFT, all in one step.  The forward FFTs are done once per
+ * block and shared by every signal extracted from it.
+ *
+ * Decimations are powers of 2 chosen so the output rate is at least
+ * EXTRACTOR_OVERSAMPLE x the signal width.  The filter passes the inner half of
+ * the output band and is down by the output Nyquist frequency.  Filters are
+ * zero phase, so output sample n lines up with input sample n * decimation.
+ */
+class SignalExtractor {
+public:
+  SignalExtractor(double initSampleRate);
+  virtual ~SignalExtractor();
+
+  inline double getSampleRate() { return sampleRate; };
+  inline void setSampleRate(double newRate) { sampleRate = newRate; };
+
+  int getDecimation(double widthHz);
+
+  // Fills in the output fields of each entry in signals from numSamples of
+  // in.
+  void extract(const SComplex *in, long numSamples,
+               ExtractedSignalVector &signals);
+
+protected:
+  double sampleRate;
+
+  // FFT's by size and filter responses by FFT size / decimation.  The filter
+  // responses are scaled by 1/fftSize to normalize the forward/inverse pair.
+  std::map<int, FFT *> forwardFFTs;
+  std::map<int, FFT *> inverseFFTs;
+  std::map<std::pair<int, int>, ComplexVector> filterResponses;
+
+  int numTaps(int decimation);
+  FFT *getFFT(std::map<int, FFT *> &ffts, int direction, int fftSize);
+  const ComplexVector &getFilter(int fftSize, int decimation);
+};
+
+/*
+ * Zoom Decimator
+ *
+ * Low pass filters and decimates a DC centered stream so a smaller FFT can
+ * look at just the middle of the band with the same bin spacing.  Only every
+ * decimation'th FIR output is computed.  The inner half of the output band
+ * is alias free; the outer quarter on each side may have aliases in it.
+ */
+class ZoomDecimator {
+public:
+  ZoomDecimator(int initDecimation);
+  virtual ~ZoomDecimator();
+
+  ZoomDecimator(const ZoomDecimator &) = delete;
+  ZoomDecimator &operator=(const ZoomDecimator &) = delete;
+
+  inline int getDecimation() { return decimation; };
+
+  // Largest power of 2 decimation that keeps +/- halfWidthHz in the alias
+  // free half of the output band, divides fftSize evenly, and leaves at least
+  // ZOOM_MIN_FFT bins.  1 means zooming wouldn't help.
+  static int selectDecimation(double sampleRate, double halfWidthHz,
+                              int fftSize);
+
+  // Filters numSamples of in into out and returns the number of samples
+  // written (numSamples / decimation).  The filter history carries over
+  // between calls, so in should continue the last call's data.
+  long decimate(const SComplex *in, long numSamples, SComplex *out);
+
+  // Clears the filter history (e.g. before data that isn't continuous).
+  void reset();
+
+protected:
+  int decimation;
+  int numTaps;
+  float *taps;
+
+  // numTaps - 1 samples of history followed by the current input
+  SComplex *workBuffer;
+  long workBufferSize;
+};
+
 } // namespace MesaSignals
 
 #endif /* LIB_SIGNALS_MESA_H_ */
@@ -0,0 +1,340 @@
+/*
+ * stats_mesa.h
+ *
+ *      Copyright 2019, Michael Piscopo
+ *
+ */
+
+#ifndef LIB_STATS_MESA_H_
+#define LIB_STATS_MESA_H_
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <float.h>
+#include <iterator>
+#include <set>
+
+namespace MesaSignals {
+
+/*
+ * Single-pass mean / variance / min / max.  Variance uses Welford's method so
+ * it stays accurate over long runs without a second pass over the data.
+ */
+class RunningStats {
+public:
+  RunningStats() { reset(); };
+  virtual ~RunningStats(){};
+
+  inline void reset() {
+    count = 0;
+    mean = 0.0;
+    m2 = 0.0;
+    minValue = FLT_MAX;
+    maxValue = -FLT_MAX;
+  };
+
+  inline void add(float value) {
+    count++;
+
+    double delta = (double)value - mean;
+    mean += delta / (double)count;
+    m2 += delta * ((double)value - mean);
+
+    if (value < minValue)
+      minValue = value;
+
+    if (value > maxValue)
+      maxValue = value;
+  };
+
+  inline long getCount() const { return count; };
+  inline double getMean() const { return mean; };
+
+  // Sample variance
+  inline double getVariance() const {
+    if (count < 2)
+      return 0.0;
+
+    return m2 / (double)(count - 1);
+  };
+
+  inline double getStdDev() const { return sqrt(getVariance()); };
+  inline float getMin() const { return minValue; };
+  inline float getMax() const { return maxValue; };
+
+protected:
+  long count;
+  double mean;
+  double m2;
+  float minValue;
+  float maxValue;
+};
+
+/*
+ * Streaming quantile estimate using the P-squared algorithm (Jain and
+ * Chlamtac, 1985).  Five markers track the min, max, the target quantile and
+ * the points halfway to it, adjusted with a parabolic fit as values arrive.
+ * O(1) memory and time per value, no sample storage.
+ */
+class P2Quantile {
+public:
+  P2Quantile(double quantile) : p(quantile) { reset(); };
+  virtual ~P2Quantile(){};
+
+  inline void reset() {
+    count = 0;
+
+    for (int i = 0; i < 5; i++) {
+      heights[i] = 0.0;
+      positions[i] = i + 1;
+    }
+
+    desired[0] = 1.0;
+    desired[1] = 1.0 + 2.0 * p;
+    desired[2] = 1.0 + 4.0 * p;
+    desired[3] = 3.0 + 2.0 * p;
+    desired[4] = 5.0;
+
+    increments[0] = 0.0;
+    increments[1] = p / 2.0;
+    increments[2] = p;
+    increments[3] = (1.0 + p) / 2.0;
+    increments[4] = 1.0;
+  };
+
+  inline void add(float value) {
+    if (count < 5) {
+      // Collect the first 5 values as the initial markers
+      heights[count++] = value;
+
+      if (count == 5)
+        std::sort(heights, heights + 5);
+
+      return;
+    }
+
+    count++;
+
+    // Find the cell the value falls in, stretching the ends if needed
+    int k;
+
+    if (value < heights[0]) {
+      heights[0] = value;
+      k = 0;
+    } else if (value >= heights[4]) {
+      heights[4] = value;
+      k = 3;
+    } else {
+      k = 0;
+      while (value >= heights[k + 1])
+        k++;
+    }
+
+    for (int i = k + 1; i < 5; i++)
+      positions[i]++;
+
+    for (int i = 0; i < 5; i++)
+      desired[i] += increments[i];
+
+    // Nudge the middle markers toward where they should be
+    for (int i = 1; i < 4; i++) {
+      double d = desired[i] - positions[i];
+
+      if (((d >= 1.0) && (positions[i + 1] - positions[i] > 1)) ||
+          ((d <= -1.0) && (positions[i - 1] - positions[i] < -1))) {
+        int sign = (d >= 0.0) ? 1 : -1;
+
+        double newHeight = parabolic(i, sign);
+
+        if ((heights[i - 1] < newHeight) && (newHeight < heights[i + 1]))
+          heights[i] = newHeight;
+        else
+          heights[i] = linear(i, sign);
+
+        positions[i] += sign;
+      }
+    }
+  };
+
+  inline long getCount() const { return count; };
+
+  inline double getValue() const {
+    if (count >= 5)
+      return heights[2];
+
+    if (count == 0)
+      return 0.0;
+
+    // Not enough values for the markers yet.  Use the exact quantile of what
+    // we have.
+    double sorted[5];
+    std::copy(heights, heights + count, sorted);
+    std::sort(sorted, sorted + count);
+
+    int index = (int)round(p * (double)(count - 1));
+    return sorted[index];
+  };
+
+protected:
+  double p;
+  long count;
+  double heights[5];
+  long positions[5];
+  double desired[5];
+  double increments[5];
+
+  inline double parabolic(int i, int sign) const {
+    double n0 = positions[i - 1];
+    double n1 = positions[i];
+    double n2 = positions[i + 1];
+
+    return heights[i] +
+           (double)sign / (n2 - n0) *
+               ((n1 - n0 + sign) * (heights[i + 1] - heights[i]) / (n2 - n1) +
+                (n2 - n1 - sign) * (heights[i] - heights[i - 1]) / (n1 - n0));
+  };
+
+  inline double linear(int i, int sign) const {
+    return heights[i] + (double)sign * (heights[i + sign] - heights[i]) /
+                            (double)(positions[i + sign] - positions[i]);
+  };
+};
+
+/*
+ * Sliding-window trimmed mean.  The window holds the last capacity values,
+ * and the mean is taken after dropping the trimCount lowest and trimCount
+ * highest.  Values are kept in three ordered sets (trimmed low, middle,
+ * trimmed high) with a running sum of the middle, so each update is
+ * O(log n) no matter how long the window is.
+ */
+class SlidingTrimmedMean {
+public:
+  SlidingTrimmedMean(long windowCapacity, long numTrimmed) {
+    capacity = windowCapacity;
+
+    if (capacity < 1)
+      capacity = 1;
+
+    // Always leave something in the middle to average
+    trimCount = numTrimmed;
+
+    if (trimCount < 0)
+      trimCount = 0;
+
+    if (2 * trimCount >= capacity)
+      trimCount = (capacity - 1) / 2;
+
+    reset();
+  };
+
+  virtual ~SlidingTrimmedMean(){};
+
+  inline void reset() {
+    window.clear();
+    low.clear();
+    mid.clear();
+    high.clear();
+    midSum = 0.0;
+    totalSum = 0.0;
+  };
+
+  inline long size() const { return window.size(); };
+  inline long getCapacity() const { return capacity; };
+  inline bool full() const { return (long)window.size() >= capacity; };
+
+  inline void add(float value) {
+    if (full()) {
+      float oldest = window.front();
+      window.pop_front();
+      remove(oldest);
+    }
+
+    window.push_back(value);
+    totalSum += value;
+
+    if (!low.empty() && (value < *low.rbegin())) {
+      low.insert(value);
+    } else if (!high.empty() && (value > *high.begin())) {
+      high.insert(value);
+    } else {
+      mid.insert(value);
+      midSum += value;
+    }
+
+    rebalance();
+  };
+
+  // Until the window has more than 2*trimCount values there's nothing left
+  // after trimming, so that's a straight average.
+  inline float getMean() const {
+    if (window.empty())
+      return 0.0;
+
+    if (((long)window.size() > 2 * trimCount) && !mid.empty())
+      return midSum / (double)mid.size();
+
+    return totalSum / (double)window.size();
+  };
+
+protected:
+  long capacity;
+  long trimCount;
+
+  std::deque<float> window;
+  std::multiset<float> low;
+  std::multiset<float> mid;
+  std::multiset<float> high;
+  double midSum;
+  double totalSum;
+
+  inline void remove(float value) {
+    totalSum -= value;
+
+    if (!low.empty() && (value <= *low.rbegin())) {
+      low.erase(low.find(value));
+    } else if (!high.empty() && (value >= *high.begin())) {
+      high.erase(high.find(value));
+    } else {
+      mid.erase(mid.find(value));
+      midSum -= value;
+    }
+  };
+
+  inline void rebalance() {
+    long target = std::min(trimCount, (long)window.size() / 2);
+
+    // Shrink first so the middle has everything the ends may need.
+    while ((long)low.size() > target) {
+      std::multiset<float>::iterator it = std::prev(low.end());
+      mid.insert(*it);
+      midSum += *it;
+      low.erase(it);
+    }
+
+    while ((long)high.size() > target) {
+      std::multiset<float>::iterator it = high.begin();
+      mid.insert(*it);
+      midSum += *it;
+      high.erase(it);
+    }
+
+    while ((long)low.size() < target) {
+      std::multiset<float>::iterator it = mid.begin();
+      low.insert(*it);
+      midSum -= *it;
+      mid.erase(it);
+    }
+
+    while ((long)high.size() < target) {
+      std::multiset<float>::iterator it = std::prev(mid.end());
+      high.insert(*it);
+      midSum -= *it;
+      mid.erase(it);
+    }
+  };
+};
+
+} // namespace MesaSignals
+
+#endif /* LIB_STATS_MESA_H_ */
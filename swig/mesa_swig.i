@@ -16,6 +16,8 @@
 #include "mesa/ioselector.h"
 #include "mesa/phase_shift.h"
 #include "mesa/AvgToMsg.h"
+#include "mesa/DiversityCombiner.h"
+#include "mesa/ArrayCalibrator.h"
 %}
 
 
@@ -36,3 +38,7 @@ GR_SWIG_BLOCK_MAGIC2(mesa, ioselector);
 GR_SWIG_BLOCK_MAGIC2(mesa, phase_shift);
 %include "mesa/AvgToMsg.h"
 GR_SWIG_BLOCK_MAGIC2(mesa, AvgToMsg);
+%include "mesa/DiversityCombiner.h"
+GR_SWIG_BLOCK_MAGIC2(mesa, DiversityCombiner);
+%include "mesa/ArrayCalibrator.h"
+GR_SWIG_BLOCK_MAGIC2(mesa, ArrayCalibrator);